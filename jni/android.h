@@ -23,6 +23,18 @@ struct fb_vinfo_t {
 	struct bitfield_t blue;
 };
 
+struct cursor_t {
+	bool painted;                   /* cursor is drawn on copy buffer */
+	int line, first, last;          /* painted cells */
+	unsigned char *save;            /* pixels under cursor */
+};
+
+struct style_cache_t {              /* pixels of last drawn style (see style_pixels()) */
+	bool valid;
+	uint16_t style;
+	uint32_t fg, bg;
+};
+
 /* struct for android */
 struct framebuffer {
 	unsigned char *buf;             /* copy of framebuffer */
@@ -31,9 +43,28 @@ struct framebuffer {
 	int line_length;                /* line length (byte) */
 	long screen_size;
 	int bytes_per_pixel;            /* BYTES per pixel */
+	int surface_bpp;                /* bytes per pixel of copy buffer (1: palette index) */
 	uint32_t color_palette[COLORS]; /* 256 color palette */
+	uint32_t *truecolor_tag;        /* rgb of converted truecolor entry */
+	uint32_t *truecolor_pixel;      /* converted truecolor entry */
+	unsigned color_generation;      /* truecolor generation of rasterized lines */
+	unsigned image_generation;      /* image store generation of rasterized lines */
+	unsigned glyph_generation;      /* DRCS generation of rasterized lines */
+	unsigned combining_generation;  /* combining arena generation of rasterized lines */
+	unsigned palette_generation;    /* palette generation of color_palette[] (OSC 4/10/11/104) */
+	bool reverse;                   /* reverse screen (DECSCNM) of rasterized lines */
+	struct style_cache_t style;     /* valid during one refresh() */
+	uint32_t sixel_tag[SIXEL_COLORS];   /* rgb of converted sixel color register */
+	uint32_t sixel_pixel[SIXEL_COLORS]; /* converted sixel color register */
 	struct point_t offset;
 	struct fb_vinfo_t vinfo;
+	struct cursor_t cursor;         /* cursor overlay */
+	uint64_t *line_hash;            /* content hash of each rasterized line */
+	int lines, cols;                /* grid size of rasterized lines (lines: number of line_hash entries) */
+	int font_width, font_height;    /* cell size of rasterized lines */
+	unsigned long lines_drawn;      /* statistics: rasterized lines */
+	unsigned long lines_skipped;    /* statistics: damaged but unchanged lines */
+	struct line_cache_t cache;      /* rasterized lines (see cache.h) */
 	struct android_app *app;
 };
 
@@ -42,7 +73,8 @@ struct app_state {
 	struct framebuffer *fb;
 	int keystate;
 	bool focused;
-	bool initialized;
+	bool initialized;               /* terminal and shell are alive */
+	bool attached;                  /* framebuffer is bound to native window */
 	//bool softkeyboard_visible;
 };
 
@@ -64,10 +96,21 @@ static inline uint32_t color2pixel(struct fb_vinfo_t *vinfo, uint32_t color)
 		+ (g << vinfo->green.offset) + (b << vinfo->blue.offset);
 }
 
+/* 24bit color: round to nearest, not truncate (for RGB_565) */
+static inline uint32_t rgb2pixel(struct fb_vinfo_t *vinfo, uint32_t rgb)
+{
+	uint32_t r, g, b;
+
+	r = ((bit_mask[8] & (rgb >> 16)) * bit_mask[vinfo->red.length] + 127) / 255;
+	g = ((bit_mask[8] & (rgb >> 8)) * bit_mask[vinfo->green.length] + 127) / 255;
+	b = ((bit_mask[8] & (rgb >> 0)) * bit_mask[vinfo->blue.length] + 127) / 255;
+
+	return (r << vinfo->red.offset)
+		+ (g << vinfo->green.offset) + (b << vinfo->blue.offset);
+}
+
 void fb_init(struct framebuffer *fb)
 {
-	extern const uint32_t color_list[COLORS];
-	int i;
 	int32_t pixel_format;
 	struct fb_vinfo_t vinfo;
 	ANativeWindow_Buffer buf;
@@ -109,15 +152,15 @@ void fb_init(struct framebuffer *fb)
 		LOGE("format:%d width:%d height:%d bytes perl pixel:%d\n",
 			pixel_format, fb->width, fb->height, fb->bytes_per_pixel);
 
-	for (i = 0; i < COLORS; i++) /* init color palette */
-		fb->color_palette[i] = color2pixel(&vinfo, color_list[i]);
+	/* indexed copy buffer is expanded by color_palette at post time */
+	fb->surface_bpp = INDEXED_SURFACE ? 1: fb->bytes_per_pixel;
 
 	if (ANativeWindow_lock(fb->app->window, &buf, NULL) < 0)
 		fatal("ANativeWindow_lock() failed");
 
 	//fb->line_length = fb->width * fb->bytes_per_pixel;
 	//fb->screen_size = fb->height * fb->line_length;
-	fb->line_length = buf.stride * fb->bytes_per_pixel;
+	fb->line_length = buf.stride * fb->surface_bpp;
 	fb->screen_size = buf.height * fb->line_length;
 
 	ANativeWindow_unlockAndPost(fb->app->window);
@@ -126,6 +169,29 @@ void fb_init(struct framebuffer *fb)
 	//fb->buf.bits = NULL;
 	fb->vinfo = vinfo;
 
+	/* allocated by refresh(): cursor size depends on font */
+	fb->cursor.painted = false;
+	fb->cursor.save    = NULL;
+
+	/* allocated by refresh() */
+	fb->line_hash = NULL;
+	fb->lines     = fb->cols = 0;
+	fb->font_width = fb->font_height = 0;
+	fb->lines_drawn = fb->lines_skipped = 0;
+	memset(&fb->cache, 0, sizeof(struct line_cache_t));
+
+	/* truecolor entries are converted at first use */
+	fb->truecolor_tag    = (uint32_t *) ecalloc(TRUECOLORS, sizeof(uint32_t));
+	fb->truecolor_pixel  = (uint32_t *) ecalloc(TRUECOLORS, sizeof(uint32_t));
+	fb->color_generation = 0;
+	fb->image_generation = 0;
+	fb->glyph_generation = 0;
+	fb->combining_generation = 0;
+	fb->palette_generation = 0; /* color_palette[] is converted by first refresh() */
+	fb->reverse = false;
+	fb->style.valid = false;
+	memset(fb->sixel_tag, 0, sizeof(fb->sixel_tag));
+
 	fb->offset.x = 0; // FIXME: hard coding!!
 	fb->offset.y = 40; // FIXME: hard coding!!
 	fb->width  -= fb->offset.x;
@@ -136,91 +202,549 @@ void fb_die(struct framebuffer *fb)
 {
 	//(void) fb;
 	free(fb->buf);
+	free(fb->cursor.save);
+	free(fb->line_hash);
+	cache_die(&fb->cache);
+	free(fb->truecolor_tag);
+	free(fb->truecolor_pixel);
 }
 
-static inline void draw_line(struct framebuffer *fb, struct terminal *term, int line)
+/* value stored in copy buffer for color index */
+static inline uint32_t surface_pixel(struct framebuffer *fb, struct terminal *term, uint16_t color)
 {
-	int pos, bdf_padding, glyph_width, margin_right;
-	int col, w, h;
-	uint32_t pixel;
-	struct color_pair_t color_pair;
-	struct cell_t *cellp;
-	const struct glyph_t *glyphp;
-
-	for (col = term->cols - 1; col >= 0; col--) {
-		margin_right = (term->cols - 1 - col) * CELL_WIDTH;
-
-		/* target cell */
-		cellp = &term->cells[col + line * term->cols];
-
-		/* get color and glyph */
-		color_pair = cellp->color_pair;
-		glyphp     = cellp->glyphp;
-
-		/* check wide character or not */
-		glyph_width = (cellp->width == HALF) ? CELL_WIDTH: CELL_WIDTH * 2;
-		bdf_padding = my_ceil(glyph_width, BITS_PER_BYTE) * BITS_PER_BYTE - glyph_width;
-		if (cellp->width == WIDE)
-			bdf_padding += CELL_WIDTH;
-
-		/* check cursor positon */
-		if ((term->mode & MODE_CURSOR && line == term->cursor.y)
-			&& (col == term->cursor.x
-			|| (cellp->width == WIDE && (col + 1) == term->cursor.x)
-			|| (cellp->width == NEXT_TO_WIDE && (col - 1) == term->cursor.x))) {
-			color_pair.fg = DEFAULT_BG;
-			color_pair.bg = ACTIVE_CURSOR_COLOR;
+	int i;
+	uint32_t rgb;
+
+	if (color < COLORS)
+		return INDEXED_SURFACE ? color: fb->color_palette[color];
+
+	/* truecolor: convert again only if entry is reused by other rgb */
+	i   = color - COLORS;
+	rgb = term->truecolor.rgb[i];
+	if (fb->truecolor_tag[i] != rgb) {
+		fb->truecolor_tag[i]   = rgb;
+		fb->truecolor_pixel[i] = INDEXED_SURFACE ?
+			nearest_color(term->palette, rgb & 0xFFFFFF): rgb2pixel(&fb->vinfo, rgb & 0xFFFFFF);
+	}
+	return fb->truecolor_pixel[i];
+}
+
+/* sixel color register: converted again only if rgb of register differs from last converted one */
+static inline uint32_t register_pixel(struct framebuffer *fb, struct terminal *term, const uint32_t *palette, int reg)
+{
+	uint32_t tag = palette[reg] | TRUECOLOR_USED; /* 0 means not converted */
+
+	if (fb->sixel_tag[reg] != tag) {
+		fb->sixel_tag[reg]   = tag;
+		fb->sixel_pixel[reg] = INDEXED_SURFACE ?
+			nearest_color(term->palette, palette[reg]): rgb2pixel(&fb->vinfo, palette[reg]);
+	}
+	return fb->sixel_pixel[reg];
+}
+
+static inline int cell_left(struct framebuffer *fb, struct terminal *term, int col)
+{
+	/* screen is right aligned: left edge (pixel) of column */
+	return term->width - (term->cols - col) * term->font.width + fb->offset.x;
+}
+
+/* pixels of cell colors with attribute and reverse screen: resolved once for run of cells with same style */
+static inline void style_pixels(struct framebuffer *fb, struct terminal *term,
+	const struct cell_t *cellp, uint32_t *fg, uint32_t *bg)
+{
+	struct style_cache_t *sp = &fb->style;
+	struct color_pair_t color;
+
+	if (!sp->valid || sp->style != cellp->style) {
+		color  = cell_style(term, cellp->style)->color;
+		sp->fg = surface_pixel(fb, term, (term->mode & MODE_REVERSE) ? color.bg: color.fg);
+		sp->bg = surface_pixel(fb, term, (term->mode & MODE_REVERSE) ? color.fg: color.bg);
+		sp->style = cellp->style;
+		sp->valid = true;
+	}
+	*fg = sp->fg;
+	*bg = sp->bg;
+}
+
+/* image tile: pixels are sampled by current cell size (image may be placed with other cell size) */
+static inline void draw_tile(struct framebuffer *fb, struct terminal *term, int line, int col, const struct cell_t *cellp)
+{
+	int pos, w, h, sx, sy, left, top;
+	uint32_t pixel, fg, bg;
+	const uint8_t *row;
+	struct image_t *ip = term->image.slot[image_slot(cellp->code)];
+
+	style_pixels(fb, term, cellp, &fg, &bg);
+	left = (cellp->code & IMAGE_TILE_MASK) % ip->tile_cols * ip->tile_width;
+	top  = (cellp->code & IMAGE_TILE_MASK) / ip->tile_cols * ip->tile_height;
+
+	for (h = 0; h < term->font.height; h++) {
+		sy  = top + h * ip->tile_height / term->font.height;
+		row = (sy < ip->height) ? ip->pixels + sy * ip->width: NULL;
+		pos = cell_left(fb, term, col) * fb->surface_bpp
+			+ (line * term->font.height + h + fb->offset.y) * fb->line_length;
+
+		for (w = 0; w < term->font.width; w++) {
+			sx    = left + w * ip->tile_width / term->font.width;
+			pixel = (row == NULL || sx >= ip->width || row[sx] == SIXEL_UNSET) ?
+				bg: register_pixel(fb, term, ip->palette, row[sx]);
+
+			memcpy(fb->buf + pos, &pixel, fb->surface_bpp);
+			pos += fb->surface_bpp;
 		}
+	}
+}
+
+/* combining character is painted over base glyph with fg (missing or wide glyph is not drawn) */
+static inline void draw_mark(struct framebuffer *fb, struct terminal *term, int line, int col, uint32_t code, uint32_t fg)
+{
+	int pos, w, h;
+	const uint8_t *glyph;
+
+	if (glyph_width(&term->font, code) != HALF)
+		return;
+	glyph = get_glyph(&term->font, code);
+
+	for (h = 0; h < term->font.height; h++) {
+		pos = cell_left(fb, term, col) * fb->surface_bpp
+			+ (line * term->font.height + h + fb->offset.y) * fb->line_length;
+		for (w = 0; w < term->font.width; w++) {
+			if (glyph[w + h * term->font.width])
+				memcpy(fb->buf + pos, &fg, fb->surface_bpp);
+			pos += fb->surface_bpp;
+		}
+	}
+}
+
+static inline void draw_cell(struct framebuffer *fb, struct terminal *term, int line, int col, bool cursor)
+{
+	int pos, pitch, offset, width;
+	int i, w, h, marks = 0;
+	uint32_t code, pixel, fg, bg;
+	bool underline;
+	struct cell_t cell;
+	const uint8_t *glyph, *mask;
+	const uint32_t *entry = NULL;
+
+	/* target cell */
+	cell = grid_cell(&term->cells, col + line * term->cols);
+
+	/* block cursor over image is drawn as blank cell */
+	code = cell.code;
+	if (code >= IMAGE_CELL) {
+		if (!cursor) {
+			draw_tile(fb, term, line, col, &cell);
+			return;
+		}
+		code = DEFAULT_CHAR;
+	}
+	else if (is_combined(code)) {
+		entry = &term->combining.code[code & COMBINED_MASK];
+		code  = entry[0];
+		marks = entry[1];
+	}
+
+	/* get glyph */
+	glyph = get_glyph(&term->font, code);
+	width = glyph_width(&term->font, code);
+
+	/* wide glyph is drawn by two cells: NEXT_TO_WIDE cell draws right half */
+	pitch  = term->font.width * width;
+	offset = (cell.width == NEXT_TO_WIDE && width == WIDE) ? term->font.width: 0;
+
+	if (cursor) {
+		fg = surface_pixel(fb, term, DEFAULT_BG);
+		bg = surface_pixel(fb, term, ACTIVE_CURSOR_COLOR);
+	}
+	else
+		style_pixels(fb, term, &cell, &fg, &bg);
+	underline = cell_style(term, cell.style)->attribute & attr_mask[ATTR_UNDERLINE];
+
+	for (h = 0; h < term->font.height; h++) {
+		/* if UNDERLINE attribute on, swap bg/fg (underline is scaled too) */
+		if ((h == (term->font.height - term->font.scale)) && underline)
+			bg = fg;
+
+		mask = glyph + offset + h * pitch;
+		pos  = cell_left(fb, term, col) * fb->surface_bpp
+			+ (line * term->font.height + h + fb->offset.y) * fb->line_length;
+
+		for (w = 0; w < term->font.width; w++) {
+			/* set color palette */
+			pixel = mask[w] ? fg: bg;
+
+			/* update copy buffer only */
+			memcpy(fb->buf + pos, &pixel, fb->surface_bpp);
+			pos += fb->surface_bpp;
+		}
+	}
+
+	/* combining characters of wide glyph are drawn on left half */
+	for (i = 0; i < marks && offset == 0; i++)
+		draw_mark(fb, term, line, col, entry[2 + i], fg);
+}
 
-		for (h = 0; h < CELL_HEIGHT; h++) {
-			/* if UNDERLINE attribute on, swap bg/fg */
-			if ((h == (CELL_HEIGHT - 1)) && (cellp->attribute & attr_mask[ATTR_UNDERLINE]))
-				color_pair.bg = color_pair.fg;
+/* copy columns of line between copy buffer and cached strip */
+static inline void copy_strip(struct framebuffer *fb, struct terminal *term,
+	int line, unsigned char *strip, int first, int last, bool save)
+{
+	int h, size, stride;
+	unsigned char *pixels;
+
+	stride = term->cols * term->font.width * fb->surface_bpp;
+	size   = (last - first + 1) * term->font.width * fb->surface_bpp;
+	strip += first * term->font.width * fb->surface_bpp;
+	pixels = fb->buf + cell_left(fb, term, first) * fb->surface_bpp
+		+ (line * term->font.height + fb->offset.y) * fb->line_length;
+
+	for (h = 0; h < term->font.height; h++) {
+		if (save)
+			memcpy(strip, pixels, size);
+		else
+			memcpy(pixels, strip, size);
+		strip  += stride;
+		pixels += fb->line_length;
+	}
+}
+
+static inline void draw_line(struct framebuffer *fb, struct terminal *term, int line)
+{
+	int col;
+	unsigned char *strip;
+	struct damage_t damage = term->damage[line];
+
+	if ((strip = cache_lookup(&fb->cache, term->line_hash[line])) != NULL) {
+		/* same content was rasterized before (maybe at another line) */
+		copy_strip(fb, term, line, strip, damage.first, damage.last, false);
+	} else {
+		/* rasterize damaged columns only */
+		for (col = damage.last; col >= damage.first; col--)
+			draw_cell(fb, term, line, col, false);
+
+		/* only whole line is cached: other columns may be covered by cursor */
+		if (damage.first == 0 && damage.last == term->cols - 1
+			&& (strip = cache_insert(&fb->cache, term->line_hash[line])) != NULL)
+			copy_strip(fb, term, line, strip, damage.first, damage.last, true);
+	}
+
+	clear_damage(term, line);
+	fb->line_hash[line] = term->line_hash[line];
+	fb->lines_drawn++;
+}
+
+/* cursor overlay: painted over the copy buffer, pixels under it are saved and restored */
+static inline void cursor_cells(struct terminal *term, int *first, int *last)
+{
+	const uint8_t *width = term->cells.width + term->cursor.x + term->cursor.y * term->cols;
+
+	/* cursor paints both halves of wide character */
+	*first = *last = term->cursor.x;
+	if (term->cursor.x > 0 && width[-1] == WIDE)
+		*first -= 1;
+	if (term->cursor.x < term->cols - 1 && width[1] == NEXT_TO_WIDE)
+		*last += 1;
+}
+
+static inline void fill_rect(struct framebuffer *fb, int x, int y, int width, int height, uint32_t pixel)
+{
+	int w, h;
+
+	for (h = y; h < y + height; h++)
+		for (w = x; w < x + width; w++)
+			memcpy(fb->buf + w * fb->surface_bpp + h * fb->line_length, &pixel, fb->surface_bpp);
+}
 
-			for (w = 0; w < CELL_WIDTH; w++) {
-				pos = (term->width - 1 - margin_right - w + fb->offset.x) * fb->bytes_per_pixel
-					+ (line * CELL_HEIGHT + h + fb->offset.y) * fb->line_length;
+static inline void cursor_pixels(struct framebuffer *fb, struct terminal *term, bool save)
+{
+	int h, size;
+	unsigned char *ptr, *saved;
+
+	size  = (fb->cursor.last - fb->cursor.first + 1) * term->font.width * fb->surface_bpp;
+	ptr   = fb->buf + cell_left(fb, term, fb->cursor.first) * fb->surface_bpp
+		+ (fb->cursor.line * term->font.height + fb->offset.y) * fb->line_length;
+	saved = fb->cursor.save;
+
+	for (h = 0; h < term->font.height; h++) {
+		if (save)
+			memcpy(saved, ptr, size);
+		else
+			memcpy(ptr, saved, size);
+		ptr   += fb->line_length;
+		saved += size;
+	}
+}
 
-				/* set color palette */
-				if (glyphp->bitmap[h] & (0x01 << (bdf_padding + w)))
-					pixel = fb->color_palette[color_pair.fg];
-				else
-					pixel = fb->color_palette[color_pair.bg];
+static inline void paint_cursor(struct framebuffer *fb, struct terminal *term)
+{
+	int col, left, top;
+
+	left = cell_left(fb, term, fb->cursor.first);
+	top  = fb->cursor.line * term->font.height + fb->offset.y;
+
+	if (cursor_shape == CURSOR_UNDERLINE)
+		fill_rect(fb, left, top + term->font.height - 2 * term->font.scale,
+			(fb->cursor.last - fb->cursor.first + 1) * term->font.width, 2 * term->font.scale,
+			surface_pixel(fb, term, ACTIVE_CURSOR_COLOR));
+	else if (cursor_shape == CURSOR_BAR)
+		fill_rect(fb, left, top, term->font.scale, term->font.height, surface_pixel(fb, term, ACTIVE_CURSOR_COLOR));
+	else /* CURSOR_BLOCK */
+		for (col = fb->cursor.first; col <= fb->cursor.last; col++)
+			draw_cell(fb, term, fb->cursor.line, col, true);
+}
 
-				/* update copy buffer only */
-				memcpy(fb->buf + pos, &pixel, fb->bytes_per_pixel);
-			}
+static inline void add_rect(struct framebuffer *fb, struct terminal *term,
+	ARect *rect, int line, int first, int last)
+{
+	int left, right, top, bottom;
+
+	left   = cell_left(fb, term, first);
+	right  = cell_left(fb, term, last + 1);
+	top    = line * term->font.height + fb->offset.y;
+	bottom = top + term->font.height;
+
+	if (left < rect->left)
+		rect->left = left;
+	if (right > rect->right)
+		rect->right = right;
+	if (top < rect->top)
+		rect->top = top;
+	if (bottom > rect->bottom)
+		rect->bottom = bottom;
+}
+
+/* palette index -> window pixel: unrolled by 4, no gather is needed for 256 entry LUT */
+static inline void expand_row(struct framebuffer *fb, unsigned char *dst, const uint8_t *src, int width)
+{
+	int i;
+	const uint32_t *lut = fb->color_palette;
+	uint32_t *dst32 = (uint32_t *) dst;
+	uint16_t *dst16 = (uint16_t *) dst;
+
+	if (fb->bytes_per_pixel == 4) {
+		for (i = 0; i + 4 <= width; i += 4) {
+			dst32[i]     = lut[src[i]];
+			dst32[i + 1] = lut[src[i + 1]];
+			dst32[i + 2] = lut[src[i + 2]];
+			dst32[i + 3] = lut[src[i + 3]];
+		}
+		for (; i < width; i++)
+			dst32[i] = lut[src[i]];
+	} else {
+		for (i = 0; i + 4 <= width; i += 4) {
+			dst16[i]     = lut[src[i]];
+			dst16[i + 1] = lut[src[i + 1]];
+			dst16[i + 2] = lut[src[i + 2]];
+			dst16[i + 3] = lut[src[i + 3]];
 		}
+		for (; i < width; i++)
+			dst16[i] = lut[src[i]];
+	}
+}
+
+static inline void copy_rect(struct framebuffer *fb, struct terminal *term, ANativeWindow_Buffer *dst_buf, ARect *rect)
+{
+	int y, left, right, top, bottom, dst_line_length;
+	int grid_left, grid_right, grid_top, grid_bottom, first, last;
+	unsigned char *dst, *src;
+
+	/* clip by window and copy buffer */
+	left   = (rect->left < 0) ? 0: rect->left;
+	top    = (rect->top < 0) ? 0: rect->top;
+	right  = (rect->right > dst_buf->width) ? dst_buf->width: rect->right;
+	bottom = (rect->bottom > dst_buf->height) ? dst_buf->height: rect->bottom;
+
+	if (right > fb->line_length / fb->surface_bpp)
+		right = fb->line_length / fb->surface_bpp;
+	if (bottom > fb->screen_size / fb->line_length)
+		bottom = fb->screen_size / fb->line_length;
+
+	if (left >= right || top >= bottom)
+		return;
+
+	dst_line_length = dst_buf->stride * fb->bytes_per_pixel;
+	dst = (unsigned char *) dst_buf->bits + top * dst_line_length + left * fb->bytes_per_pixel;
+	src = fb->buf + top * fb->line_length + left * fb->surface_bpp;
+
+	/* margin outside of grid is black as in direct mode (index 0 may be changed by OSC 4) */
+	grid_left   = cell_left(fb, term, 0);
+	grid_right  = cell_left(fb, term, term->cols);
+	grid_top    = fb->offset.y;
+	grid_bottom = fb->offset.y + term->lines * term->font.height;
+
+	for (y = top; y < bottom; y++) {
+		if (INDEXED_SURFACE) {
+			first = (grid_left < left) ? left: (grid_left > right) ? right: grid_left;
+			last  = (grid_right < first) ? first: (grid_right > right) ? right: grid_right;
+			if (y < grid_top || y >= grid_bottom)
+				first = last = right;
+			memset(dst, 0, (first - left) * fb->bytes_per_pixel);
+			expand_row(fb, dst + (first - left) * fb->bytes_per_pixel, src + (first - left), last - first);
+			memset(dst + (last - left) * fb->bytes_per_pixel, 0, (right - last) * fb->bytes_per_pixel);
+		}
+		else
+			memcpy(dst, src, (right - left) * fb->bytes_per_pixel);
+		dst += dst_line_length;
+		src += fb->line_length;
 	}
-	term->line_dirty[line] = ((term->mode & MODE_CURSOR) && term->cursor.y == line) ? true: false;
 }
 
 void refresh(struct framebuffer *fb, struct terminal *term)
 {
-	int line;
+	int i, line, first = 0, last = 0;
+	size_t strip_size;
+	bool visible, update, clear = false, recolor = false;
+	ARect rect;
+	struct damage_t *dp;
+	struct cursor_t *cp = &fb->cursor;
 	ANativeWindow_Buffer dst_buf;
 
 	if (fb->app->window == NULL)
 		return;
 
-	if (ANativeWindow_lock(fb->app->window, &dst_buf, NULL) < 0)
+	/* synchronized output: damage is accumulated and committed by one post */
+	if (is_synchronized(term))
 		return;
 
-	if (DEBUG)
-		LOGE("format:%d stride:%d width:%d height:%d\n",
-			dst_buf.format, dst_buf.stride, dst_buf.width, dst_buf.height);
+	/* cells and line hashes are read below */
+	flush_scroll(term);
+
+	if (fb->lines != term->lines || fb->cols != term->cols
+		|| fb->font_width != term->font.width || fb->font_height != term->font.height) {
+		/* new copy buffer, terminal resized or glyph scaled: nothing is rasterized yet */
+		fb->line_hash = (uint64_t *) erealloc(fb->line_hash, term->lines * sizeof(uint64_t));
+		fb->lines     = term->lines;
+		fb->cols      = term->cols;
+		for (line = 0; line < term->lines; line++)
+			fb->line_hash[line] = term->line_hash[line] + 1; /* never match */
+
+		/* old grid (and cursor) may be left outside of new grid */
+		fb->font_width     = term->font.width;
+		fb->font_height    = term->font.height;
+		fb->cursor.painted = false;
+		memset(fb->buf, 0, fb->screen_size);
+		cache_flush(&fb->cache);
+		clear = true;
+
+		/* cursor may cover wide character and its neighbor */
+		fb->cursor.save = (unsigned char *) erealloc(fb->cursor.save,
+			term->font.width * 3 * term->font.height * fb->surface_bpp);
+		redraw(term);
+	}
 
-	if (term->mode & MODE_CURSOR)
-		term->line_dirty[term->cursor.y] = true;
+	/* cells that use changed color index have new hash (see set_palette()): only cursor is repainted here */
+	if (fb->palette_generation != term->palette_generation) {
+		for (i = 0; i < COLORS; i++)
+			fb->color_palette[i] = color2pixel(&fb->vinfo, term->palette[i]);
+		fb->palette_generation = term->palette_generation;
+		recolor = true;
+
+		/* palette index surface: truecolor and sixel pixels are quantized to changed palette again */
+		if (INDEXED_SURFACE) {
+			memset(fb->truecolor_tag, 0, TRUECOLORS * sizeof(uint32_t));
+			memset(fb->sixel_tag, 0, sizeof(fb->sixel_tag));
+			for (line = 0; line < term->lines; line++)
+				fb->line_hash[line] = term->line_hash[line] + 1;
+			cache_flush(&fb->cache);
+			redraw(term);
+		}
+	}
+
+	/* palette or truecolor entries may be changed since last refresh */
+	fb->style.valid = false;
+
+	if (fb->color_generation != term->truecolor.generation
+		|| fb->image_generation != term->image.generation
+		|| fb->glyph_generation != term->font.generation
+		|| fb->combining_generation != term->combining.generation
+		|| fb->reverse != ((term->mode & MODE_REVERSE) != 0)) {
+		/* freed truecolor entries or image slots may be reused, DRCS glyph may be redefined,
+			combining entries may be moved, or screen is reversed: same hash can mean other pixels */
+		fb->color_generation = term->truecolor.generation;
+		fb->image_generation = term->image.generation;
+		fb->glyph_generation = term->font.generation;
+		fb->combining_generation = term->combining.generation;
+		fb->reverse          = (term->mode & MODE_REVERSE) != 0;
+		for (line = 0; line < term->lines; line++)
+			fb->line_hash[line] = term->line_hash[line] + 1;
+		cache_flush(&fb->cache);
+	}
+
+	strip_size = term->cols * term->font.width * term->font.height * fb->surface_bpp;
+	if (fb->cache.strip_size != strip_size) {
+		/* cached strips have different width */
+		cache_die(&fb->cache);
+		cache_init(&fb->cache, strip_size, LINE_CACHE_SIZE);
+	}
+
+	/* skip lines that were damaged but have same content as rasterized one */
+	for (line = next_damaged(term, 0); line < term->lines; line = next_damaged(term, line + 1)) {
+		if (fb->line_hash[line] == term->line_hash[line]) {
+			clear_damage(term, line);
+			fb->lines_skipped++;
+		}
+	}
 
-	for (line = 0; line < term->lines; line++) {
-		if (term->line_dirty[line])
-			draw_line(fb, term, line);
+	/* cursor overlay must be repainted only if it moved or cells under it changed */
+	visible = (term->mode & MODE_CURSOR) ? true: false;
+	if (visible)
+		cursor_cells(term, &first, &last);
+
+	update = (cp->painted != visible) || (cp->painted && recolor);
+	if (cp->painted && visible)
+		update |= (cp->line != term->cursor.y || cp->first != first || cp->last != last);
+	if (cp->painted && is_damaged(term, cp->line)) {
+		dp = &term->damage[cp->line];
+		update |= (dp->first <= cp->last && dp->last >= cp->first);
 	}
-	//memcpy(dst_buf.bits, fb->buf.bits, fb->screen_size);
-	memcpy(dst_buf.bits, fb->buf, fb->screen_size);
 
-	//fb->buf = dst_buf;
+	/* dirty rectangle: bounding box of damaged cells and cursor */
+	rect.left = rect.top = INT_MAX;
+	rect.right = rect.bottom = 0;
+
+	for (line = next_damaged(term, 0); line < term->lines; line = next_damaged(term, line + 1))
+		add_rect(fb, term, &rect, line, term->damage[line].first, term->damage[line].last);
+
+	if (update && cp->painted)
+		add_rect(fb, term, &rect, cp->line, cp->first, cp->last);
+	if (update && visible)
+		add_rect(fb, term, &rect, term->cursor.y, first, last);
+
+	if (clear) { /* whole copy buffer */
+		rect.left   = rect.top = 0;
+		rect.right  = fb->line_length / fb->surface_bpp;
+		rect.bottom = fb->screen_size / fb->line_length;
+	}
+
+	if (rect.top == INT_MAX) /* nothing to draw */
+		return;
+
+	/* window may enlarge rect (if it cannot preserve previous buffer) */
+	if (ANativeWindow_lock(fb->app->window, &dst_buf, &rect) < 0)
+		return;
+
+	if (DEBUG)
+		LOGE("format:%d stride:%d width:%d height:%d dirty:(%d,%d)-(%d,%d) lines drawn:%lu skipped:%lu cache hit:%lu miss:%lu sgr cache hit:%lu miss:%lu styles:%d\n",
+			dst_buf.format, dst_buf.stride, dst_buf.width, dst_buf.height,
+			rect.left, rect.top, rect.right, rect.bottom, fb->lines_drawn, fb->lines_skipped,
+			fb->cache.hits, fb->cache.misses, term->sgr_cache.hits, term->sgr_cache.misses, term->style.count);
+
+	if (update && cp->painted) {
+		cursor_pixels(fb, term, false); /* restore */
+		cp->painted = false;
+	}
+
+	for (line = next_damaged(term, 0); line < term->lines; line = next_damaged(term, line + 1))
+		draw_line(fb, term, line);
+
+	if (update && visible) {
+		cp->line  = term->cursor.y;
+		cp->first = first;
+		cp->last  = last;
+		cursor_pixels(fb, term, true); /* save */
+		paint_cursor(fb, term);
+		cp->painted = true;
+	}
+	copy_rect(fb, term, &dst_buf, &rect);
 
 	ANativeWindow_unlockAndPost(fb->app->window);
 }
@@ -0,0 +1,155 @@
+/* See LICENSE for licence details. */
+/* rendered line cache: LRU of rasterized line strips, keyed by line content hash */
+enum {
+	CACHE_NONE = -1, /* end of list/chain */
+};
+
+struct cache_entry_t {
+	uint64_t key;    /* line hash */
+	bool used;
+	int prev, next;  /* LRU list (prev: more recent) */
+	int chain;       /* next entry of same hash bucket */
+};
+
+struct line_cache_t {
+	unsigned char *pixels;        /* strips: entries * strip_size */
+	size_t strip_size;            /* bytes per strip */
+	int entries;                  /* number of strips (0: cache disabled) */
+	struct cache_entry_t *entry;
+	int *bucket;                  /* head of hash chain */
+	int buckets;                  /* power of 2 */
+	int head, tail;               /* most/least recently used entry */
+	unsigned long hits, misses;   /* statistics */
+};
+
+static inline unsigned char *cache_strip(struct line_cache_t *cache, int index)
+{
+	return cache->pixels + (size_t) index * cache->strip_size;
+}
+
+static inline void cache_unlink(struct line_cache_t *cache, int index)
+{
+	struct cache_entry_t *ep = &cache->entry[index];
+
+	if (ep->prev != CACHE_NONE)
+		cache->entry[ep->prev].next = ep->next;
+	else
+		cache->head = ep->next;
+
+	if (ep->next != CACHE_NONE)
+		cache->entry[ep->next].prev = ep->prev;
+	else
+		cache->tail = ep->prev;
+}
+
+static inline void cache_push_front(struct line_cache_t *cache, int index)
+{
+	struct cache_entry_t *ep = &cache->entry[index];
+
+	ep->prev = CACHE_NONE;
+	ep->next = cache->head;
+	if (cache->head != CACHE_NONE)
+		cache->entry[cache->head].prev = index;
+	cache->head = index;
+	if (cache->tail == CACHE_NONE)
+		cache->tail = index;
+}
+
+void cache_flush(struct line_cache_t *cache)
+{
+	int i;
+
+	cache->head = cache->tail = CACHE_NONE;
+	for (i = 0; i < cache->buckets; i++)
+		cache->bucket[i] = CACHE_NONE;
+
+	for (i = 0; i < cache->entries; i++) {
+		cache->entry[i].used  = false;
+		cache->entry[i].chain = CACHE_NONE;
+		cache_push_front(cache, i);
+	}
+}
+
+void cache_init(struct line_cache_t *cache, size_t strip_size, size_t budget)
+{
+	cache->strip_size = strip_size;
+	cache->entries    = (strip_size > 0) ? budget / strip_size: 0;
+	cache->hits = cache->misses = 0;
+
+	cache->buckets = 1;
+	while (cache->buckets < cache->entries * 2)
+		cache->buckets *= 2;
+
+	if (DEBUG)
+		LOGE("line cache: strip size:%u entries:%d\n", (unsigned) strip_size, cache->entries);
+
+	cache->pixels = (cache->entries > 0) ?
+		(unsigned char *) ecalloc(cache->entries, strip_size): NULL;
+	cache->entry  = (cache->entries > 0) ?
+		(struct cache_entry_t *) ecalloc(cache->entries, sizeof(struct cache_entry_t)): NULL;
+	cache->bucket = (int *) ecalloc(cache->buckets, sizeof(int));
+
+	cache_flush(cache);
+}
+
+void cache_die(struct line_cache_t *cache)
+{
+	free(cache->pixels);
+	free(cache->entry);
+	free(cache->bucket);
+	cache->pixels = NULL;
+	cache->entry  = NULL;
+	cache->bucket = NULL;
+	cache->entries = cache->buckets = 0;
+	cache->strip_size = 0;
+}
+
+/* return strip of key or NULL */
+unsigned char *cache_lookup(struct line_cache_t *cache, uint64_t key)
+{
+	int index;
+
+	if (cache->entries == 0)
+		return NULL;
+
+	for (index = cache->bucket[key & (cache->buckets - 1)]; index != CACHE_NONE;
+		index = cache->entry[index].chain) {
+		if (cache->entry[index].key == key) {
+			cache_unlink(cache, index);
+			cache_push_front(cache, index);
+			cache->hits++;
+			return cache_strip(cache, index);
+		}
+	}
+	cache->misses++;
+	return NULL;
+}
+
+/* evict least recently used entry and return its strip for new key */
+unsigned char *cache_insert(struct line_cache_t *cache, uint64_t key)
+{
+	int index, *ip;
+	struct cache_entry_t *ep;
+
+	if (cache->entries == 0)
+		return NULL;
+
+	index = cache->tail;
+	ep    = &cache->entry[index];
+
+	if (ep->used) { /* remove from old hash chain */
+		for (ip = &cache->bucket[ep->key & (cache->buckets - 1)]; *ip != index;
+			ip = &cache->entry[*ip].chain);
+		*ip = ep->chain;
+	}
+
+	ep->key   = key;
+	ep->used  = true;
+	ep->chain = cache->bucket[key & (cache->buckets - 1)];
+	cache->bucket[key & (cache->buckets - 1)] = index;
+
+	cache_unlink(cache, index);
+	cache_push_front(cache, index);
+
+	return cache_strip(cache, index);
+}
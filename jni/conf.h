@@ -3,6 +3,9 @@
 /* TERM value */
 const char *term_name = "yaft-256color"; /* default TERM */
 
+/* PSF2 font: compiled-in glyphs are used if not found */
+const char *font_path = "/sdcard/yaft/font.psf";
+
 /* color: index number of color_palette[] (see color.h) */
 enum {
 	DEFAULT_FG           = 7,
@@ -11,15 +14,25 @@ enum {
 	PASSIVE_CURSOR_COLOR = 1,
 };
 
+/* cursor shape: CURSOR_BLOCK or CURSOR_UNDERLINE or CURSOR_BAR */
+const enum cursor_shape cursor_shape = CURSOR_BLOCK;
+
 /* misc */
 enum {
 	DEBUG            = false,  /* write dump of input to stdout, debug message to stderr */
 	TABSTOP          = 8,      /* hardware tabstop */
-	LAZY_DRAW        = false,  /* don't draw when input data size is larger than BUFSIZE */
+	LAZY_DRAW        = false,  /* don't draw when input data size is larger than READ_BUFSIZE */
 	BACKGROUND_DRAW  = false,  /* always draw even if vt is not active */
 	WALLPAPER        = false,  /* copy framebuffer before startup, and use it as wallpaper */
 	SUBSTITUTE_HALF  = 0x0020, /* used for missing glyph(single width): U+0020 (SPACE) */
 	SUBSTITUTE_WIDE  = 0x3013, /* used for missing glyph(double width): U+3013 (GETA MARK) */
 	REPLACEMENT_CHAR = 0x0020, /* used for malformed UTF-8 sequence   : U+0020 (SPACE) */
 	AMBWIDTH_IS_WIDE = false,  /* ambiguous width character is wide or not (see Unicode EastAsianWidth.txt) */
+	BOLD_IS_BRIGHT   = true,   /* bold attribute brightens foreground color 0-7 (blink brightens background) */
+	LINE_CACHE_SIZE  = 4 * 1024 * 1024, /* memory budget of rasterized line cache (byte): 0 disables cache */
+	INDEXED_SURFACE  = false,  /* copy buffer holds 8bit palette index, expanded to window format at post time */
+	FONT_SCALE       = 0,      /* integer scale of glyph: 0 means display density / 160 (Ctrl+Alt+'='/'-' to change) */
+	GLYPH_ATLAS_SIZE = 2 * 1024 * 1024, /* memory cap of scaled glyph atlas (byte) */
+	IMAGE_STORE_SIZE = 16 * 1024 * 1024, /* memory budget of sixel images (byte): least recently placed one is evicted */
+	SYNC_TIMEOUT     = 200,    /* limit of synchronized output (msec): screen is drawn even if app never ends it */
 };
@@ -0,0 +1,178 @@
+/* See LICENSE for licence details. */
+/* DRCS: soft font (DECDLD) is decoded in place into per charset glyph pool of font
+	format: DCS Pfn;Pcn;Pe;Pcmw;Pss;Pt;Pcmh;Pcss { Dscs Sxbp1;Sxbp2;...;Sxbpn ST
+	glyph has cell size of font (Pcmw and Pcmh are ignored: larger glyph is clipped),
+	and is printed by DRCSMMv1 code point (see drcs_glyph()) */
+enum {
+	DRCS_DSCS   = -1, /* decoder: waiting Dscs */
+	DRCS_IGNORE = -2, /* decoder: final char of Dscs is not 0x40-0x7E */
+};
+
+/* glyph becomes blank and defined */
+void drcs_define(struct font_t *font, int charset, int glyph)
+{
+	uint32_t code = DRCS_GLYPH + charset * GLYPH_PER_CHARSET + glyph;
+
+	memset(font->drcs[charset] + glyph * drcs_glyph_size(font), 0, drcs_glyph_size(font));
+	font->index[code]       = charset * GLYPH_PER_CHARSET + glyph;
+	font->atlas_index[code] = 0; /* scaled glyph is decoded again */
+}
+
+/* defined glyphs of charset become blank */
+void drcs_erase(struct font_t *font, int charset)
+{
+	int i;
+
+	if (font->drcs[charset] == NULL)
+		return;
+
+	for (i = 0; i < GLYPH_PER_CHARSET; i++) {
+		if (font->index[DRCS_GLYPH + charset * GLYPH_PER_CHARSET + i] != GLYPH_MISSING)
+			drcs_define(font, charset, i);
+	}
+}
+
+void drcs_charset(struct terminal *term, uint8_t final)
+{
+	int i;
+	struct drcs_t *dp = &term->drcs;
+	struct font_t *font = &term->font;
+
+	if (final < '@' || final > '~') {
+		dp->charset = DRCS_IGNORE;
+		return;
+	}
+	dp->charset = final - '@';
+
+	if (dp->erase == 2) {
+		for (i = 0; i < DRCS_CHARSETS; i++)
+			drcs_erase(font, i);
+	}
+	else if (dp->erase == 0)
+		drcs_erase(font, dp->charset);
+
+	if (font->drcs[dp->charset] == NULL)
+		font->drcs[dp->charset] = (uint8_t *) ecalloc(GLYPH_PER_CHARSET, drcs_glyph_size(font));
+
+	if (dp->glyph < GLYPH_PER_CHARSET)
+		drcs_define(font, dp->charset, dp->glyph);
+}
+
+/* paint sixel (6 vertical pixels) of current glyph */
+static inline void drcs_put(struct font_t *font, struct drcs_t *dp, int bits)
+{
+	int i, pitch;
+	uint8_t *bitmap;
+
+	if (dp->charset < 0 || dp->glyph >= GLYPH_PER_CHARSET || dp->x >= font->src_width)
+		return;
+
+	pitch  = my_ceil(font->src_width, BITS_PER_BYTE);
+	bitmap = font->drcs[dp->charset] + dp->glyph * drcs_glyph_size(font);
+
+	for (i = 0; i < BITS_PER_SIXEL && dp->y + i < font->src_height; i++) {
+		if (bits & (1 << i))
+			bitmap[(dp->y + i) * pitch + dp->x / BITS_PER_BYTE] |= 0x80 >> (dp->x % BITS_PER_BYTE);
+	}
+	dp->x++;
+}
+
+void drcs_start(struct terminal *term)
+{
+	struct parm_t parm;
+	struct drcs_t *dp = &term->drcs;
+
+	*(term->esc.bp - 1) = '\0'; /* omit final character */
+
+	if (DEBUG)
+		LOGE("drcs: DCS %s\n", term->esc.buf + 1);
+
+	reset_parm(&parm);
+	parse_arg(term->esc.buf + 1, &parm, ';', isdigit); /* skip 'P' */
+
+	/* Pcn: first glyph (0: SPACE), Pe: erase control */
+	dp->glyph   = (parm.argc >= 2) ? dec2num(parm.argv[1]): 0;
+	dp->erase   = (parm.argc >= 3) ? dec2num(parm.argv[2]): 0;
+	if (dp->glyph < 0 || dp->glyph > GLYPH_PER_CHARSET)
+		dp->glyph = GLYPH_PER_CHARSET; /* nothing is loaded */
+	dp->charset = DRCS_DSCS;
+	dp->x = dp->y = 0;
+	dp->esc = false;
+
+	term->esc.state = STATE_DRCS;
+}
+
+void drcs_finish(struct terminal *term)
+{
+	int x, y;
+	uint32_t code;
+
+	if (term->drcs.charset >= 0) {
+		/* glyphs may be redefined: lines that have DRCS glyph are drawn again */
+		term->font.generation++;
+		flush_scroll(term);
+		for (y = 0; y < term->lines; y++) {
+			for (x = 0; x < term->cols; x++) {
+				code = term->cells.code[x + y * term->cols];
+				if (is_combined(code))
+					code = term->combining.code[code & COMBINED_MASK];
+				if (DRCS_GLYPH <= code && code < GLYPHS) {
+					damage_line(term, y);
+					break;
+				}
+			}
+		}
+	}
+	reset_esc(term);
+}
+
+/* decode soft font until ST (or BEL): return number of consumed bytes */
+int drcs_parse(struct terminal *term, const uint8_t *buf, int size)
+{
+	int i;
+	uint8_t ch;
+	struct drcs_t *dp = &term->drcs;
+
+	for (i = 0; i < size; i++) {
+		ch = buf[i];
+
+		if (dp->esc) {
+			/* ESC '\' (ST) terminates soft font: other escape sequence interrupts it */
+			dp->esc = false;
+			drcs_finish(term);
+			if (ch == BACKSLASH)
+				return i + 1;
+			term->esc.state = STATE_ESC; /* ch is not consumed (may be 0 byte) */
+			return i;
+		}
+
+		if (dp->charset == DRCS_DSCS && ('0' <= ch && ch <= '~')) {
+			drcs_charset(term, ch); /* intermediate chars of Dscs are ignored */
+		}
+		else if (dp->charset == DRCS_DSCS && (SPACE <= ch && ch <= '/')) {
+			continue;
+		}
+		else if ('?' <= ch && ch <= '~') {
+			drcs_put(&term->font, dp, ch - '?');
+		}
+		else if (ch == '/') { /* next sixel row */
+			dp->x = 0;
+			if (dp->y < term->font.src_height)
+				dp->y += BITS_PER_SIXEL;
+		}
+		else if (ch == ';') { /* next glyph */
+			dp->x = dp->y = 0;
+			if (dp->charset >= 0 && dp->glyph < GLYPH_PER_CHARSET && ++dp->glyph < GLYPH_PER_CHARSET)
+				drcs_define(&term->font, dp->charset, dp->glyph);
+		}
+		else if (ch == ESC) {
+			dp->esc = true;
+		}
+		else if (ch == BEL || ch == CAN || ch == SUB) {
+			drcs_finish(term);
+			return i + 1;
+		}
+		/* others (CR, LF...) are ignored */
+	}
+	return size;
+}
@@ -0,0 +1,291 @@
+/* See LICENSE for licence details. */
+/* font: compiled-in glyphs (glyph.h) or mmap'ed PSF2 file (and DRCS glyphs),
+	each glyph is decoded (and scaled) at first use */
+enum {
+	PSF2_MAGIC       = 0x864AB572,
+	PSF2_HAS_UNICODE = 0x01, /* header flag: unicode table follows bitmaps */
+	PSF2_STARTSEQ    = 0xFE, /* unicode table: start of combining sequence */
+	PSF2_SEPARATOR   = 0xFF, /* unicode table: end of glyph entry */
+};
+
+enum {
+	GLYPH_MISSING = -1, /* font->index[]: no glyph */
+	GLYPH_BLANK   = -2, /* font->index[]: blank wide glyph (substitute for half width font) */
+	DRCS_GLYPH    = UCS2_CHARS, /* glyph code of DRCS: DRCS_GLYPH + charset * GLYPH_PER_CHARSET + (char - SPACE) */
+	GLYPHS        = DRCS_GLYPH + DRCS_CHARSETS * GLYPH_PER_CHARSET,
+};
+
+struct psf2_header_t {
+	uint32_t magic, version;
+	uint32_t headersize;       /* offset of bitmaps */
+	uint32_t flags;
+	uint32_t length;           /* number of glyphs */
+	uint32_t charsize;         /* bytes per glyph */
+	uint32_t height, width;
+};
+
+/* DRCSMMv1: U+10XXYY (XX: final char of Dscs 0x40-0x7E, YY: 0x20-0x7F), return glyph code or 0 */
+static inline uint32_t drcs_glyph(uint32_t code)
+{
+	uint32_t charset = (code >> 8) & 0xFF, ch = code & 0xFF;
+
+	if ((code & 0xFF0000) != 0x100000 || charset < 0x40 || charset > 0x7E || ch < SPACE || ch > DEL)
+		return 0;
+	return DRCS_GLYPH + (charset - 0x40) * GLYPH_PER_CHARSET + (ch - SPACE);
+}
+
+/* bytes per DRCS glyph: rows are padded to byte boundary like PSF2 */
+static inline int drcs_glyph_size(struct font_t *font)
+{
+	return font->src_height * my_ceil(font->src_width, BITS_PER_BYTE);
+}
+
+/* return 0 if glyph is missing (DRCS glyph is always half width) */
+static inline int glyph_width(struct font_t *font, uint32_t code)
+{
+	if (code >= GLYPHS || font->index[code] == GLYPH_MISSING)
+		return 0;
+	else if (font->index[code] == GLYPH_BLANK)
+		return WIDE;
+	else
+		return (font->map == NULL && code < DRCS_GLYPH && font->index[code] >= NARROW_GLYPHS) ? WIDE: HALF;
+}
+
+/* code must have glyph (glyph_width() > 0): returned mask is valid until next get_glyph() */
+const uint8_t *get_glyph(struct font_t *font, uint32_t code)
+{
+	int x, y, pitch, src_pitch, padding, scale, ref;
+	uint32_t bits;
+	size_t size;
+	uint8_t *mask;
+	const unsigned char *bitmap, *row;
+
+	if (font->atlas_index[code] != 0)
+		return font->atlas + font->atlas_index[code] - 1;
+
+	scale     = font->scale;
+	pitch     = font->width * glyph_width(font, code);
+	src_pitch = pitch / scale;
+	size      = pitch * font->height;
+
+	if (font->atlas_used + size > font->atlas_size) {
+		/* atlas is full: forget all glyphs */
+		if (DEBUG)
+			LOGE("glyph atlas is full: flushed\n");
+		memset(font->atlas_index, 0, GLYPHS * sizeof(uint32_t));
+		font->atlas_used = 0;
+	}
+
+	mask = font->atlas + font->atlas_used;
+	font->atlas_index[code] = font->atlas_used + 1;
+	font->atlas_used += size;
+
+	if (font->index[code] == GLYPH_BLANK) {
+		memset(mask, 0, size);
+	}
+	else if (font->map == NULL && code < DRCS_GLYPH) {
+		/* glyph.h: rows are MSB first in narrow_bitmap[] or wide_bitmap[] */
+		ref     = font->index[code];
+		padding = my_ceil(src_pitch, BITS_PER_BYTE) * BITS_PER_BYTE - src_pitch;
+		for (y = 0; y < font->height; y++) {
+			bits = (ref < NARROW_GLYPHS) ?
+				narrow_bitmap[ref][y / scale]: wide_bitmap[ref - NARROW_GLYPHS][y / scale];
+			for (x = 0; x < pitch; x++)
+				mask[x + y * pitch] = (bits >> (padding + src_pitch - 1 - x / scale)) & 0x01;
+		}
+	}
+	else {
+		/* psf2 bitmap or DRCS pool: rows are padded to byte boundary, MSB first */
+		bitmap = (code >= DRCS_GLYPH) ?
+			font->drcs[font->index[code] / GLYPH_PER_CHARSET] + font->index[code] % GLYPH_PER_CHARSET * drcs_glyph_size(font):
+			font->bitmap + font->index[code] * font->bytes_per_glyph;
+		for (y = 0; y < font->height; y++) {
+			row = bitmap + (y / scale) * my_ceil(src_pitch, BITS_PER_BYTE);
+			for (x = 0; x < pitch; x++)
+				mask[x + y * pitch] = (row[x / scale / BITS_PER_BYTE] >> (BITS_PER_BYTE - 1 - x / scale % BITS_PER_BYTE)) & 0x01;
+		}
+	}
+	return mask;
+}
+
+/* scaled glyphs are expanded into atlas at first use */
+void set_font_scale(struct font_t *font, int scale)
+{
+	font->scale  = scale;
+	font->width  = font->src_width * scale;
+	font->height = font->src_height * scale;
+
+	/* atlas must hold at least one wide glyph */
+	font->atlas_size = font->width * WIDE * font->height;
+	if (font->atlas_size < GLYPH_ATLAS_SIZE)
+		font->atlas_size = GLYPH_ATLAS_SIZE;
+
+	font->atlas      = (uint8_t *) erealloc(font->atlas, font->atlas_size);
+	font->atlas_used = 0;
+	memset(font->atlas_index, 0, GLYPHS * sizeof(uint32_t));
+}
+
+/* decode one UTF-8 character of unicode table: return length or 0 */
+static int psf2_utf8(const unsigned char *cp, const unsigned char *end, uint32_t *code)
+{
+	int i, len;
+
+	if (*cp < 0x80) {
+		*code = *cp;
+		return 1;
+	}
+	else if ((*cp & 0xE0) == 0xC0) {
+		*code = *cp & 0x1F;
+		len = 2;
+	}
+	else if ((*cp & 0xF0) == 0xE0) {
+		*code = *cp & 0x0F;
+		len = 3;
+	}
+	else if ((*cp & 0xF8) == 0xF0) {
+		*code = *cp & 0x07;
+		len = 4;
+	}
+	else
+		return 0;
+
+	if (end - cp < len)
+		return 0;
+
+	for (i = 1; i < len; i++) {
+		if ((cp[i] & 0xC0) != 0x80)
+			return 0;
+		*code = (*code << 6) | (cp[i] & 0x3F);
+	}
+	return len;
+}
+
+/* only header and unicode table are read here */
+bool load_psf2(struct font_t *font, const char *path)
+{
+	int fd, len;
+	uint32_t i, code;
+	struct stat st;
+	struct psf2_header_t header;
+	const unsigned char *cp, *end;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct psf2_header_t)) {
+		eclose(fd);
+		return false;
+	}
+
+	font->size = st.st_size;
+	font->map  = (unsigned char *) emmap(NULL, font->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	eclose(fd);
+
+	memcpy(&header, font->map, sizeof(struct psf2_header_t));
+
+	if (header.magic != PSF2_MAGIC
+		|| header.width == 0 || header.height == 0
+		|| header.width > UINT8_MAX || header.height > UINT8_MAX
+		|| header.charsize != header.height * my_ceil(header.width, BITS_PER_BYTE)
+		|| header.headersize > font->size
+		|| (font->size - header.headersize) / header.charsize < header.length) {
+		LOGE("%s: invalid PSF2 font\n", path);
+		emunmap(font->map, font->size);
+		font->map = NULL;
+		return false;
+	}
+
+	font->src_width  = header.width;
+	font->src_height = header.height;
+	font->bitmap = font->map + header.headersize;
+	font->bytes_per_glyph = header.charsize;
+
+	if (!(header.flags & PSF2_HAS_UNICODE)) {
+		/* glyph number is code point */
+		for (code = 0; code < header.length && code < UCS2_CHARS; code++)
+			font->index[code] = code;
+		return true;
+	}
+
+	cp  = font->bitmap + header.length * header.charsize;
+	end = font->map + font->size;
+
+	for (i = 0; i < header.length && cp < end; i++) {
+		/* each entry: code points, then combining sequences, then separator */
+		while (cp < end && *cp != PSF2_SEPARATOR && *cp != PSF2_STARTSEQ) {
+			if ((len = psf2_utf8(cp, end, &code)) == 0)
+				break;
+			if (code < UCS2_CHARS && font->index[code] < 0)
+				font->index[code] = i;
+			cp += len;
+		}
+		while (cp < end && *cp != PSF2_SEPARATOR)
+			cp++;
+		cp++;
+	}
+	return true;
+}
+
+void font_init(struct font_t *font, const char *path, int scale)
+{
+	uint32_t code, i;
+
+	font->index       = (int32_t *) ecalloc(GLYPHS, sizeof(int32_t));
+	font->atlas_index = (uint32_t *) ecalloc(GLYPHS, sizeof(uint32_t));
+	font->atlas       = NULL;
+	for (code = 0; code < GLYPHS; code++)
+		font->index[code] = GLYPH_MISSING;
+
+	/* DRCS glyphs are loaded by DECDLD (see drcs.h) */
+	for (i = 0; i < DRCS_CHARSETS; i++)
+		font->drcs[i] = NULL;
+	font->generation = 0;
+
+	font->map = NULL;
+	if (path != NULL && load_psf2(font, path)) {
+		if (DEBUG)
+			LOGE("font: %s (%dx%d)\n", path, font->src_width, font->src_height);
+
+		if (font->index[DEFAULT_CHAR] >= 0 && font->index[SUBSTITUTE_HALF] >= 0) {
+			/* half width font: substitute of wide character is blank
+				(even if font has glyph of SUBSTITUTE_WIDE: it is half width) */
+			font->index[SUBSTITUTE_WIDE] = GLYPH_BLANK;
+			set_font_scale(font, scale);
+			return;
+		}
+
+		LOGE("%s: cannot find DEFAULT_CHAR or SUBSTITUTE_HALF, use compiled-in font\n", path);
+		emunmap(font->map, font->size);
+		font->map = NULL;
+		for (code = 0; code < UCS2_CHARS; code++)
+			font->index[code] = GLYPH_MISSING;
+	}
+
+	/* compiled-in glyphs */
+	font->src_width  = CELL_WIDTH;
+	font->src_height = CELL_HEIGHT;
+
+	for (i = 0; i < GLYPH_CODES; i++)
+		font->index[glyph_code[i]] = glyph_ref[i];
+
+	if (font->index[DEFAULT_CHAR] < 0
+		|| font->index[SUBSTITUTE_HALF] < 0
+		|| font->index[SUBSTITUTE_WIDE] < 0)
+		fatal("cannot find DEFAULT_CHAR or SUBSTITUTE_HALF or SUBSTITUTE_HALF\n");
+
+	set_font_scale(font, scale);
+}
+
+void font_die(struct font_t *font)
+{
+	int i;
+
+	for (i = 0; i < DRCS_CHARSETS; i++)
+		free(font->drcs[i]);
+	free(font->atlas);
+	free(font->atlas_index);
+	free(font->index);
+
+	if (font->map != NULL)
+		emunmap(font->map, font->size);
+}
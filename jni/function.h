@@ -18,15 +18,9 @@ void bs(struct terminal *term)
 
 void tab(struct terminal *term)
 {
-	int i;
+	int x = bit_next(term->tabstop, term->cursor.x + 1, term->cols);
 
-	for (i = term->cursor.x + 1; i < term->cols; i++) {
-		if (term->tabstop[i]) {
-			set_cursor(term, term->cursor.y, i);
-			return;
-		}
-	}
-	set_cursor(term, term->cursor.y, term->cols - 1);
+	set_cursor(term, term->cursor.y, (x < term->cols) ? x: term->cols - 1);
 }
 
 void nl(struct terminal *term)
@@ -71,7 +65,7 @@ void crnl(struct terminal *term)
 
 void set_tabstop(struct terminal *term)
 {
-	term->tabstop[term->cursor.x] = true;
+	bit_set(term->tabstop, term->cursor.x);
 }
 
 void reverse_nl(struct terminal *term)
@@ -107,17 +101,15 @@ void ris(struct terminal *term)
 /* function for csi sequence */
 void insert_blank(struct terminal *term, struct parm_t *parm)
 {
-	int i, num = sum(parm);
+	int num = sum(parm), x = term->cursor.x;
 
 	if (num <= 0)
 		num = 1;
+	else if (num > term->cols - x)
+		num = term->cols - x;
 
-	for (i = term->cols - 1; term->cursor.x <= i; i--) {
-		if (term->cursor.x <= (i - num))
-			copy_cell(term, term->cursor.y, i, term->cursor.y, i - num);
-		else
-			erase_cell(term, term->cursor.y, i);
-	}
+	move_cells(term, term->cursor.y, x + num, x, term->cols - x - num);
+	fill_cells(term, term->cursor.y, x, x + num - 1);
 }
 
 void curs_up(struct terminal *term, struct parm_t *parm)
@@ -188,72 +180,64 @@ void curs_col(struct terminal *term, struct parm_t *parm)
 	set_cursor(term, term->cursor.y, num);
 }
 
-void curs_pos(struct terminal *term, struct parm_t *parm)
+/* handlers with decoded arguments: also called by fast path (see csi_fast()) */
+void curs_pos_num(struct terminal *term, int argc, const int *argv)
 {
-	int line, col;
-
-	if (parm->argc <= 0) {
+	if (argc <= 0)
 		set_cursor(term, 0, 0);
-		return;
-	}
-
-	if (parm->argc != 2)
-		return;
-
-	line = dec2num(parm->argv[0]) - 1;
-	col  = dec2num(parm->argv[1]) - 1;
-	set_cursor(term, line, col);
+	else if (argc == 2)
+		set_cursor(term, argv[0] - 1, argv[1] - 1);
 }
 
-void erase_display(struct terminal *term, struct parm_t *parm)
+void curs_pos(struct terminal *term, struct parm_t *parm)
 {
-	int i, j, mode, last = parm->argc - 1;
+	int argv[2];
 
-	mode = (parm->argc == 0) ? 0: dec2num(parm->argv[last]);
+	if (parm->argc == 2) {
+		argv[0] = dec2num(parm->argv[0]);
+		argv[1] = dec2num(parm->argv[1]);
+	}
+	curs_pos_num(term, parm->argc, argv);
+}
 
-	if (mode < 0 || 2 < mode)
-		return;
+void erase_display_mode(struct terminal *term, int mode)
+{
+	int i;
 
 	if (mode == 0) {
-		for (i = term->cursor.y; i < term->lines; i++)
-			for (j = 0; j < term->cols; j++)
-				if (i > term->cursor.y || (i == term->cursor.y && j >= term->cursor.x))
-					erase_cell(term, i, j);
+		fill_cells(term, term->cursor.y, term->cursor.x, term->cols - 1);
+		for (i = term->cursor.y + 1; i < term->lines; i++)
+			fill_cells(term, i, 0, term->cols - 1);
 	}
 	else if (mode == 1) {
-		for (i = 0; i <= term->cursor.y; i++)
-			for (j = 0; j < term->cols; j++)
-				if (i < term->cursor.y || (i == term->cursor.y && j <= term->cursor.x))
-					erase_cell(term, i, j);
+		for (i = 0; i < term->cursor.y; i++)
+			fill_cells(term, i, 0, term->cols - 1);
+		fill_cells(term, term->cursor.y, 0, term->cursor.x);
 	}
 	else if (mode == 2) {
 		for (i = 0; i < term->lines; i++)
-			for (j = 0; j < term->cols; j++)
-				erase_cell(term, i, j);
+			fill_cells(term, i, 0, term->cols - 1);
 	}
 }
 
-void erase_line(struct terminal *term, struct parm_t *parm)
+void erase_display(struct terminal *term, struct parm_t *parm)
 {
-	int i, mode, last = parm->argc - 1;
-
-	mode = (parm->argc == 0) ? 0: dec2num(parm->argv[last]);
+	erase_display_mode(term, (parm->argc == 0) ? 0: dec2num(parm->argv[parm->argc - 1]));
+}
 
-	if (mode < 0 || 2 < mode)
-		return;
+void erase_line_mode(struct terminal *term, int mode)
+{
+	if (mode == 0)
+		fill_cells(term, term->cursor.y, term->cursor.x, term->cols - 1);
+	else if (mode == 1)
+		fill_cells(term, term->cursor.y, 0, term->cursor.x);
+	else if (mode == 2)
+		fill_cells(term, term->cursor.y, 0, term->cols - 1);
+}
 
-	if (mode == 0) {
-		for (i = term->cursor.x; i < term->cols; i++)
-			erase_cell(term, term->cursor.y, i);
-	}
-	else if (mode == 1) {
-		for (i = 0; i <= term->cursor.x; i++)
-			erase_cell(term, term->cursor.y, i);
-	}
-	else if (mode == 2) {
-		for (i = 0; i < term->cols; i++)
-			erase_cell(term, term->cursor.y, i);
-	}
+void erase_line(struct terminal *term, struct parm_t *parm)
+{
+	erase_line_mode(term, (parm->argc == 0) ? 0: dec2num(parm->argv[parm->argc - 1]));
 }
 
 void insert_line(struct terminal *term, struct parm_t *parm)
@@ -286,29 +270,27 @@ void delete_line(struct terminal *term, struct parm_t *parm)
 
 void delete_char(struct terminal *term, struct parm_t *parm)
 {
-	int i, num = sum(parm);
+	int num = sum(parm), x = term->cursor.x;
 
-	num = (num <= 0) ? 1 : num;
+	if (num <= 0)
+		num = 1;
+	else if (num > term->cols - x)
+		num = term->cols - x;
 
-	for (i = term->cursor.x; i < term->cols; i++) {
-		if ((i + num) < term->cols)
-			copy_cell(term, term->cursor.y, i, term->cursor.y, i + num);
-		else
-			erase_cell(term, term->cursor.y, i);
-	}
+	move_cells(term, term->cursor.y, x, x + num, term->cols - x - num);
+	fill_cells(term, term->cursor.y, term->cols - num, term->cols - 1);
 }
 
 void erase_char(struct terminal *term, struct parm_t *parm)
 {
-	int i, num = sum(parm);
+	int num = sum(parm);
 
 	if (num <= 0)
 		num = 1;
 	else if (num + term->cursor.x > term->cols)
 		num = term->cols - term->cursor.x;
 
-	for (i = term->cursor.x; i < term->cursor.x + num; i++)
-		erase_cell(term, term->cursor.y, i);
+	fill_cells(term, term->cursor.y, term->cursor.x, term->cursor.x + num - 1);
 }
 
 void curs_line(struct terminal *term, struct parm_t *parm)
@@ -323,54 +305,168 @@ void curs_line(struct terminal *term, struct parm_t *parm)
 	set_cursor(term, num, term->cursor.x);
 }
 
-void set_attr(struct terminal *term, struct parm_t *parm)
+/* 38;5;n or 38;2;r;g;b (48 too): return number of consumed parameters */
+int extended_color(struct terminal *term, int argc, const int *argv, int i, uint16_t *color)
 {
-	int i, num;
+	int type, index;
+	uint32_t r, g, b;
 
-	if (parm->argc == 0) {
-		term->attribute = ATTR_RESET;
-		term->color_pair.fg = DEFAULT_FG;
-		term->color_pair.bg = DEFAULT_BG;
-		return;
+	if ((i + 1) >= argc)
+		return 0;
+
+	type = argv[i + 1];
+	if (type == 5 && (i + 2) < argc) {        /* 256 color */
+		index = argv[i + 2];
+		if (0 <= index && index < COLORS)
+			*color = index;
+		return 2;
+	}
+	else if (type == 2 && (i + 4) < argc) {   /* 24bit color */
+		r = bit_mask[8] & argv[i + 2];
+		g = bit_mask[8] & argv[i + 3];
+		b = bit_mask[8] & argv[i + 4];
+		*color = truecolor_index(term, (r << 16) | (g << 8) | b);
+		return 4;
+	}
+	return 0;
+}
+
+static inline void reset_sgr(struct sgr_t *sgr)
+{
+	sgr->keep   = 0xFF;
+	sgr->set    = ATTR_RESET;
+	sgr->set_fg = sgr->set_bg = false;
+}
+
+static inline void apply_sgr(struct terminal *term, const struct sgr_t *sgr)
+{
+	term->attribute = (term->attribute & sgr->keep) | sgr->set;
+	if (sgr->set_fg)
+		term->color_pair.fg = sgr->color_pair.fg;
+	if (sgr->set_bg)
+		term->color_pair.bg = sgr->color_pair.bg;
+}
+
+static inline void sgr_color(struct sgr_t *sgr, bool fg, uint16_t color)
+{
+	if (fg) {
+		sgr->color_pair.fg = color;
+		sgr->set_fg = true;
+	} else {
+		sgr->color_pair.bg = color;
+		sgr->set_bg = true;
 	}
+}
 
-	for (i = 0; i < parm->argc; i++) {
-		num = dec2num(parm->argv[i]);
+/* accumulate effect of SGR parameters to sgr: return false if it refers 24bit color
+	(interned color may be freed later: effect before 24bit color is applied to terminal first, see truecolor_gc()) */
+bool parse_sgr(struct terminal *term, int argc, const int *argv, struct sgr_t *sgr)
+{
+	int i, num;
+	bool reusable = true;
+	uint16_t color;
+
+	if (argc == 0) {
+		sgr->keep = 0;
+		sgr->set  = ATTR_RESET;
+		sgr_color(sgr, true, DEFAULT_FG);
+		sgr_color(sgr, false, DEFAULT_BG);
+		return true;
+	}
+
+	for (i = 0; i < argc; i++) {
+		num = argv[i];
 
 		if (num == 0) {                    /* reset all attribute and color */
-			term->attribute = ATTR_RESET;
-			term->color_pair.fg = DEFAULT_FG;
-			term->color_pair.bg = DEFAULT_BG;
+			sgr->keep = 0;
+			sgr->set  = ATTR_RESET;
+			sgr_color(sgr, true, DEFAULT_FG);
+			sgr_color(sgr, false, DEFAULT_BG);
 		}
 		else if (1 <= num && num <= 7)     /* set attribute */
-			term->attribute |= attr_mask[num];
-		else if (21 <= num && num <= 27)   /* reset attribute */
-			term->attribute &= ~attr_mask[num - 20];
+			sgr->set |= attr_mask[num];
+		else if (21 <= num && num <= 27) { /* reset attribute */
+			sgr->keep &= ~attr_mask[num - 20];
+			sgr->set  &= ~attr_mask[num - 20];
+		}
 		else if (30 <= num && num <= 37)   /* set foreground */
-			term->color_pair.fg = (num - 30);
-		else if (num == 38) {              /* set 256 color to foreground */
-			if ((i + 2) < parm->argc && dec2num(parm->argv[i + 1]) == 5) {
-				term->color_pair.fg = dec2num(parm->argv[i + 2]);
-				i += 2;
+			sgr_color(sgr, true, num - 30);
+		else if (num == 38 || num == 48) { /* set 256 color or 24bit color to foreground/background */
+			if ((i + 1) < argc && argv[i + 1] == 2) {
+				apply_sgr(term, sgr);
+				reset_sgr(sgr);
+				reusable = false;
 			}
+			color = UINT16_MAX;
+			i += extended_color(term, argc, argv, i, &color);
+			if (color != UINT16_MAX)
+				sgr_color(sgr, num == 38, color);
 		}
 		else if (num == 39)                /* reset foreground */
-			term->color_pair.fg = DEFAULT_FG;
+			sgr_color(sgr, true, DEFAULT_FG);
 		else if (40 <= num && num <= 47)   /* set background */
-			term->color_pair.bg = (num - 40);
-		else if (num == 48) {              /* set 256 color to background */
-			if ((i + 2) < parm->argc && dec2num(parm->argv[i + 1]) == 5) {
-				term->color_pair.bg = dec2num(parm->argv[i + 2]);
-				i += 2;
-			}
-		}
+			sgr_color(sgr, false, num - 40);
 		else if (num == 49)                /* reset background */
-			term->color_pair.bg = DEFAULT_BG;
+			sgr_color(sgr, false, DEFAULT_BG);
 		else if (90 <= num && num <= 97)   /* set bright foreground */
-			term->color_pair.fg = (num - 90) + BRIGHT_INC;
+			sgr_color(sgr, true, (num - 90) + BRIGHT_INC);
 		else if (100 <= num && num <= 107) /* set bright background */
-			term->color_pair.bg = (num - 100) + BRIGHT_INC;
+			sgr_color(sgr, false, (num - 100) + BRIGHT_INC);
+	}
+	return reusable;
+}
+
+void set_attr_num(struct terminal *term, int argc, const int *argv)
+{
+	struct sgr_t sgr;
+
+	reset_sgr(&sgr);
+	parse_sgr(term, argc, argv, &sgr);
+	apply_sgr(term, &sgr);
+}
+
+/* SGR cache: parameter string of fast path -> effect (string that has 24bit color is not cached) */
+static inline struct sgr_entry_t *sgr_entry(struct terminal *term, uint64_t hash)
+{
+	return &term->sgr_cache.entry[hash & (SGR_CACHE_SIZE - 1)];
+}
+
+/* return false if str is not cached */
+bool cached_attr(struct terminal *term, const uint8_t *str, int len, uint64_t hash)
+{
+	struct sgr_entry_t *ep = sgr_entry(term, hash);
+
+	if (!ep->used || ep->len != len || memcmp(ep->key, str, len) != 0) {
+		term->sgr_cache.misses++;
+		return false;
 	}
+	apply_sgr(term, &ep->sgr);
+	term->sgr_cache.hits++;
+	return true;
+}
+
+void set_attr_cached(struct terminal *term, const uint8_t *str, int len, uint64_t hash, int argc, const int *argv)
+{
+	struct sgr_t sgr;
+	struct sgr_entry_t *ep = sgr_entry(term, hash);
+
+	reset_sgr(&sgr);
+	if (parse_sgr(term, argc, argv, &sgr) && len <= SGR_KEY_SIZE) {
+		ep->used = true;
+		ep->len  = len;
+		memcpy(ep->key, str, len);
+		ep->sgr  = sgr;
+	}
+	apply_sgr(term, &sgr);
+}
+
+void set_attr(struct terminal *term, struct parm_t *parm)
+{
+	int i, argv[MAX_ARGS];
+
+	for (i = 0; i < parm->argc; i++)
+		argv[i] = dec2num(parm->argv[i]);
+	set_attr_num(term, parm->argc, argv);
 }
 
 void status_report(struct terminal *term, struct parm_t *parm)
@@ -404,10 +500,19 @@ void set_mode(struct terminal *term, struct parm_t *parm)
 			term->mode |= MODE_ORIGIN;
 			set_cursor(term, 0, 0);
 		}
+		else if (mode == 5 && !(term->mode & MODE_REVERSE)) {
+			term->mode |= MODE_REVERSE;
+			redraw(term); /* cells are not changed: colors are swapped by renderer */
+		}
 		else if (mode == 7)
 			term->mode |= MODE_AMRIGHT;
 		else if (mode == 25)
 			term->mode |= MODE_CURSOR;
+		else if (mode == 2026) {
+			/* refresh() is suppressed and damage accumulates until reset or SYNC_TIMEOUT */
+			term->mode |= MODE_SYNC;
+			clock_gettime(CLOCK_MONOTONIC, &term->sync_start);
+		}
 	}
 
 }
@@ -425,12 +530,18 @@ void reset_mode(struct terminal *term, struct parm_t *parm)
 			term->mode &= ~MODE_ORIGIN;
 			set_cursor(term, 0, 0);
 		}
+		else if (mode == 5 && (term->mode & MODE_REVERSE)) {
+			term->mode &= ~MODE_REVERSE;
+			redraw(term);
+		}
 		else if (mode == 7) {
 			term->mode &= ~MODE_AMRIGHT;
 			term->wrap_occured = false;
 		}
 		else if (mode == 25)
 			term->mode &= ~MODE_CURSOR;
+		else if (mode == 2026)
+			term->mode &= ~MODE_SYNC;
 	}
 
 }
@@ -461,18 +572,17 @@ void set_margin(struct terminal *term, struct parm_t *parm)
 
 void clear_tabstop(struct terminal *term, struct parm_t *parm)
 {
-	int i, j, num;
+	int i, num;
 
 	if (parm->argc == 0)
-		term->tabstop[term->cursor.x] = false;
+		bit_clear(term->tabstop, term->cursor.x);
 	else {
 		for (i = 0; i < parm->argc; i++) {
 			num = dec2num(parm->argv[i]);
 			if (num == 0)
-				term->tabstop[term->cursor.x] = false;
+				bit_clear(term->tabstop, term->cursor.x);
 			else if (num == 3) {
-				for (j = 0; j < term->cols; j++)
-					term->tabstop[j] = false;
+				bit_fill(term->tabstop, 0, term->cols - 1, false);
 				return;
 			}
 		}
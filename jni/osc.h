@@ -0,0 +1,294 @@
+/* See LICENSE for licence details. */
+/* OSC: payload is passed to handler byte by byte, and each handler keeps at most its own limit
+	(unsupported OSC and DCS are discarded without buffering) */
+struct osc_func_t {
+	void (*put)(struct terminal *term, uint8_t ch); /* payload byte */
+	void (*flush)(struct terminal *term);           /* end of payload (or argument) */
+};
+
+extern const struct osc_func_t osc_func[OSC_FUNCS];
+
+/* window title: OSC 0 (icon name and title), OSC 2 (title) */
+void title_put(struct terminal *term, uint8_t ch)
+{
+	if (term->osc.len < OSC_TITLE_SIZE - 1)
+		term->title[term->osc.len++] = ch;
+}
+
+void title_flush(struct terminal *term)
+{
+	term->title[term->osc.len] = '\0';
+
+	if (DEBUG)
+		LOGE("title: %s\n", term->title);
+}
+
+/* arguments separated by ';': flush is called for each argument (esc.buf) */
+void arg_put(struct terminal *term, uint8_t ch)
+{
+	if (ch == ';') {
+		*term->esc.bp = '\0';
+		osc_func[term->osc.cmd].flush(term);
+		term->esc.bp = term->esc.buf;
+		term->osc.arg++;
+	}
+	else if (term->esc.bp - term->esc.buf < term->esc.size - 1)
+		*term->esc.bp++ = ch;
+	else
+		term->esc.buf[0] = ';'; /* too long argument: invalid */
+}
+
+static inline bool is_number(const char *str)
+{
+	return *str != '\0' && strspn(str, "0123456789") == strlen(str) && strlen(str) <= 3;
+}
+
+/* "rgb:R/G/B" (1-4 hex digits, scaled) or "#RGB" (1-4 hex digits, MSB aligned) */
+bool parse_color(const char *spec, uint32_t *rgb)
+{
+	int i, len, digits;
+	uint32_t value, max;
+	char hex[5];
+
+	*rgb = 0;
+	if (strncmp(spec, "rgb:", 4) == 0) {
+		spec += 4;
+		for (i = 0; i < 3; i++) {
+			digits = strspn(spec, "0123456789ABCDEFabcdef");
+			if (digits < 1 || digits > 4 || spec[digits] != ((i < 2) ? '/': '\0'))
+				return false;
+			memcpy(hex, spec, digits);
+			hex[digits] = '\0';
+			value = hex2num(hex);
+			max   = (1 << (digits * 4)) - 1;
+			*rgb  = (*rgb << 8) | ((value * 0xFF + max / 2) / max);
+			spec += digits + 1;
+		}
+		return true;
+	}
+	else if (spec[0] == '#') {
+		len    = strlen(++spec);
+		digits = len / 3;
+		if (digits < 1 || digits > 4 || len % 3 != 0
+			|| (int) strspn(spec, "0123456789ABCDEFabcdef") != len)
+			return false;
+		for (i = 0; i < 3; i++) {
+			memcpy(hex, spec + i * digits, digits);
+			hex[digits] = '\0';
+			value = hex2num(hex);
+			*rgb  = (*rgb << 8) | ((digits == 1) ? value << 4: value >> ((digits - 2) * 4));
+		}
+		return true;
+	}
+	return false;
+}
+
+/* reply of color query: OSC Ps;rgb:RRRR/GGGG/BBBB ST */
+void reply_color(struct terminal *term, const char *ps, uint32_t rgb)
+{
+	char buf[BUFSIZE];
+
+	snprintf(buf, BUFSIZE, "\033]%s;rgb:%.4X/%.4X/%.4X\033\\", ps,
+		((rgb >> 16) & 0xFF) * 0x101, ((rgb >> 8) & 0xFF) * 0x101, (rgb & 0xFF) * 0x101);
+	ewrite(term->fd, buf, strlen(buf));
+}
+
+/* OSC 4: c;spec;c;spec... (spec "?" is query) */
+void palette_flush(struct terminal *term)
+{
+	char ps[BUFSIZE];
+	uint32_t rgb;
+
+	if (term->osc.arg % 2 == 0) {
+		term->osc.index = is_number(term->esc.buf) ? dec2num(term->esc.buf): -1;
+		if (term->osc.index >= COLORS)
+			term->osc.index = -1;
+	}
+	else if (term->osc.index < 0) {
+		return;
+	}
+	else if (strcmp(term->esc.buf, "?") == 0) {
+		snprintf(ps, BUFSIZE, "4;%d", term->osc.index);
+		reply_color(term, ps, term->palette[term->osc.index]);
+	}
+	else if (parse_color(term->esc.buf, &rgb))
+		set_palette(term, term->osc.index, rgb);
+}
+
+/* OSC 104: c;c... (no argument: all colors) */
+void reset_palette_flush(struct terminal *term)
+{
+	int i;
+
+	if (term->osc.arg == 0 && term->esc.buf[0] == '\0') {
+		for (i = 0; i < COLORS; i++)
+			set_palette(term, i, color_list[i]);
+	}
+	else if (is_number(term->esc.buf) && dec2num(term->esc.buf) < COLORS)
+		set_palette(term, dec2num(term->esc.buf), color_list[dec2num(term->esc.buf)]);
+}
+
+/* OSC 10/11: spec;spec... (default fg, default bg: following spec sets next one)
+	default colors are color index DEFAULT_FG and DEFAULT_BG */
+void dynamic_color_flush(struct terminal *term)
+{
+	char ps[BUFSIZE];
+	int dynamic = term->osc.cmd - 10 + term->osc.arg;
+	int index   = (dynamic == 0) ? DEFAULT_FG: DEFAULT_BG;
+	uint32_t rgb;
+
+	if (dynamic > 1)
+		return;
+
+	if (strcmp(term->esc.buf, "?") == 0) {
+		snprintf(ps, BUFSIZE, "%d", 10 + dynamic);
+		reply_color(term, ps, term->palette[index]);
+	}
+	else if (parse_color(term->esc.buf, &rgb))
+		set_palette(term, index, rgb);
+}
+
+/* OSC 110/111: reset default fg/bg */
+void reset_dynamic_color_flush(struct terminal *term)
+{
+	int index = (term->osc.cmd == 110) ? DEFAULT_FG: DEFAULT_BG;
+
+	set_palette(term, index, color_list[index]);
+}
+
+/* OSC 52: Pc;base64 ("?" query is not answered) */
+void clipboard_put(struct terminal *term, uint8_t ch)
+{
+	uint32_t value;
+
+	if (term->osc.arg == 0) { /* selection (Pc) is ignored */
+		if (ch == ';')
+			term->osc.arg++;
+		return;
+	}
+
+	if ('A' <= ch && ch <= 'Z')
+		value = ch - 'A';
+	else if ('a' <= ch && ch <= 'z')
+		value = ch - 'a' + 26;
+	else if ('0' <= ch && ch <= '9')
+		value = ch - '0' + 52;
+	else if (ch == '+' || ch == '/')
+		value = (ch == '+') ? 62: 63;
+	else /* padding or invalid */
+		return;
+
+	term->osc.bits   = (term->osc.bits << 6) | value;
+	term->osc.nbits += 6;
+	if (term->osc.nbits >= BITS_PER_BYTE) {
+		term->osc.nbits -= BITS_PER_BYTE;
+		if (term->osc.len < OSC_CLIPBOARD_SIZE) {
+			if (term->clipboard == NULL)
+				term->clipboard = (uint8_t *) ecalloc(1, OSC_CLIPBOARD_SIZE);
+			term->clipboard[term->osc.len++] = term->osc.bits >> term->osc.nbits;
+		}
+	}
+}
+
+void clipboard_flush(struct terminal *term)
+{
+	/* only new data replaces clipboard (query or empty data does not) */
+	if (term->osc.len > 0)
+		term->clipboard_len = term->osc.len;
+
+	if (DEBUG)
+		LOGE("clipboard: %d bytes\n", term->clipboard_len);
+}
+
+const struct osc_func_t osc_func[OSC_FUNCS] = {
+	[0]   = { title_put,     title_flush },
+	[2]   = { title_put,     title_flush },
+	[4]   = { arg_put,       palette_flush },
+	[10]  = { arg_put,       dynamic_color_flush },
+	[11]  = { arg_put,       dynamic_color_flush },
+	[52]  = { clipboard_put, clipboard_flush },
+	[104] = { arg_put,       reset_palette_flush },
+	[110] = { NULL,          reset_dynamic_color_flush },
+	[111] = { NULL,          reset_dynamic_color_flush },
+};
+
+/* header is "]" Ps ";" (other header: payload is discarded) */
+static inline int osc_cmd(struct terminal *term, int len)
+{
+	int cmd;
+
+	term->esc.buf[len] = '\0';
+	if (len < 2 || strspn(term->esc.buf + 1, "0123456789") != (size_t) (len - 1) || len > 4)
+		return OSC_IGNORE;
+
+	cmd = dec2num(term->esc.buf + 1);
+	return (cmd < OSC_FUNCS && osc_func[cmd].flush != NULL) ? cmd: OSC_IGNORE;
+}
+
+void osc_start(struct terminal *term)
+{
+	long len = term->esc.bp - term->esc.buf;
+
+	if (DEBUG)
+		LOGE("osc: OSC %.*s\n", (int) len - 1, term->esc.buf + 1);
+
+	start_string(term, (term->esc.buf[len - 1] == ';') ? osc_cmd(term, len - 1): OSC_IGNORE);
+}
+
+void osc_end(struct terminal *term)
+{
+	if (term->osc.cmd != OSC_IGNORE) {
+		*term->esc.bp = '\0';
+		osc_func[term->osc.cmd].flush(term);
+	}
+	reset_esc(term);
+}
+
+/* OSC terminated without payload: "]" Ps BEL or "]" Ps ESC '\' */
+void osc_sequence(struct terminal *term, uint8_t ch)
+{
+	int cmd;
+	long len = term->esc.bp - term->esc.buf - ((ch == BEL) ? 1: 2);
+
+	if ((cmd = osc_cmd(term, len)) != OSC_IGNORE) {
+		start_string(term, cmd);
+		osc_end(term);
+	}
+	reset_esc(term);
+}
+
+/* pass payload to handler until ST (or BEL): return number of consumed bytes */
+int osc_parse(struct terminal *term, const uint8_t *buf, int size)
+{
+	int i;
+	uint8_t ch;
+
+	for (i = 0; i < size; i++) {
+		ch = buf[i];
+
+		if (term->osc.esc) {
+			/* ESC '\' (ST) terminates payload: other escape sequence interrupts it */
+			term->osc.esc = false;
+			osc_end(term);
+			if (ch == BACKSLASH)
+				return i + 1;
+			term->esc.state = STATE_ESC; /* ch is not consumed (may be 0 byte) */
+			return i;
+		}
+
+		if (ch == ESC) {
+			term->osc.esc = true;
+		}
+		else if (ch == BEL) {
+			osc_end(term);
+			return i + 1;
+		}
+		else if (ch == CAN || ch == SUB) {
+			reset_esc(term);
+			return i + 1;
+		}
+		else if (term->osc.cmd != OSC_IGNORE && osc_func[term->osc.cmd].put != NULL)
+			osc_func[term->osc.cmd].put(term, ch);
+	}
+	return size;
+}
@@ -109,10 +109,69 @@ void csi_sequence(struct terminal *term, uint8_t ch)
 	reset_esc(term);
 }
 
-void osc_sequence(struct terminal *term, uint8_t ch)
+/* parameter string of fast path: decoded same as parse_arg() (empty argument is 0)
+	return false if it has too many arguments or too long number (dec2num() may saturate) */
+static inline bool decode_args(const uint8_t *str, int len, int *argc, int *argv)
 {
-	(void) ch;
-	reset_esc(term);
+	int i, digits = 0;
+
+	*argc   = 0;
+	argv[0] = 0;
+	for (i = 0; i < len; i++) {
+		if (str[i] == ';') {
+			if (++*argc >= MAX_ARGS)
+				return false;
+			argv[*argc] = digits = 0;
+		}
+		else if (++digits > 4)
+			return false;
+		else
+			argv[*argc] = argv[*argc] * 10 + (str[i] - '0');
+	}
+	if (len > 0)
+		(*argc)++;
+
+	return true;
+}
+
+/* fast path of frequent CSI (SGR, CUP, ED, EL): ESC '[' [num] {';' [num]} F
+	sequence is decoded in buf without esc.buf and parse_arg(), and handler is called with numbers
+	(SGR seen before is applied from cache without decoding)
+	return consumed bytes, or 0 if sequence is other one or not complete in buf (general path) */
+int csi_fast(struct terminal *term, const uint8_t *buf, int size)
+{
+	int i, len, argc, argv[MAX_ARGS];
+	uint64_t hash = fnv_basis;
+
+	if (size < 3 || buf[1] != '[')
+		return 0;
+
+	for (i = 2; i < size && (('0' <= buf[i] && buf[i] <= '9') || buf[i] == ';'); i++)
+		hash = fnv1a(hash, buf[i]);
+
+	if (i >= size)
+		return 0;
+	len = i - 2;
+
+	if (buf[i] == 'm' && cached_attr(term, buf + 2, len, hash))
+		; /* done */
+	else if (!decode_args(buf + 2, len, &argc, argv))
+		return 0;
+	else if (buf[i] == 'm')
+		set_attr_cached(term, buf + 2, len, hash, argc, argv);
+	else if (buf[i] == 'H' || buf[i] == 'f')
+		curs_pos_num(term, argc, argv);
+	else if (buf[i] == 'J')
+		erase_display_mode(term, (argc == 0) ? 0: argv[argc - 1]);
+	else if (buf[i] == 'K')
+		erase_line_mode(term, (argc == 0) ? 0: argv[argc - 1]);
+	else
+		return 0;
+
+	if (DEBUG)
+		LOGE("csi: CSI %.*s (fast path)\n", len + 1, buf + 2);
+
+	return i + 1;
 }
 
 void dcs_sequence(struct terminal *term, uint8_t ch)
@@ -200,6 +259,50 @@ void utf8_charset(struct terminal *term, uint8_t ch)
 	}
 }
 
+/* length of plain text: printable, UTF-8 and cursor movement without scroll up */
+static inline int plain_text(const uint8_t *buf, int size)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		if (buf[i] < SPACE && buf[i] != CR && buf[i] != LF && buf[i] != HT && buf[i] != BS)
+			break;
+	}
+	return i;
+}
+
+/* scroll-off elision: return length of plain text whose output never appears on screen, or 0
+	- its last LF scrolls: cursor reaches bottom before it (auto wrap only adds scrolls)
+	- (lines - 1) LFs follow it in buf: scroll out all lines above bottom (which is blank after last LF) */
+int scroll_off_length(struct terminal *term, const uint8_t *buf, int size)
+{
+	int i, lf = 0, total = 0, last;
+
+	if (term->scroll.top != 0 || term->scroll.bottom != term->lines - 1)
+		return 0;
+
+	for (i = 0; i < size; i++)
+		total += (buf[i] == LF);
+
+	last = total - (term->lines - 1);
+	if (last < 1 || last - 1 < term->scroll.bottom - term->cursor.y)
+		return 0;
+
+	for (i = 0; lf < last; i++)
+		lf += (buf[i] == LF);
+	return i;
+}
+
+/* end of scroll-off elision: screen is same as writing all cells and scrolling them out */
+void end_scroll_off(struct terminal *term)
+{
+	int y;
+
+	term->scrolling_off = false;
+	for (y = 0; y < term->lines; y++)
+		fill_cells(term, y, 0, term->cols - 1);
+}
+
 void parse(struct terminal *term, uint8_t *buf, int size)
 {
 	/*
@@ -209,9 +312,23 @@ void parse(struct terminal *term, uint8_t *buf, int size)
 		UTF-8           : 0x80 ~ 0xFF
 	*/
 	uint8_t ch;
-	int i;
+	int i, len, plain_end = 0, scroll_off_end = 0;
 
 	for (i = 0; i < size; i++) {
+		if (term->scrolling_off && i == scroll_off_end)
+			end_scroll_off(term);
+
+		/* plain text burst: lines that scroll out before end of buf are not written (only cursor moves) */
+		if (term->esc.state == STATE_RESET && i >= plain_end) {
+			plain_end = i + plain_text(buf + i, size - i);
+			scroll_off_end = i + scroll_off_length(term, buf + i, plain_end - i);
+			if (scroll_off_end > i) {
+				if (DEBUG)
+					LOGE("scroll-off elision: %d bytes\n", scroll_off_end - i);
+				term->scrolling_off = true;
+			}
+		}
+
 		ch = buf[i];
 		if (term->esc.state == STATE_RESET) {
 			/* interrupted by illegal byte */
@@ -220,7 +337,9 @@ void parse(struct terminal *term, uint8_t *buf, int size)
 				reset_charset(term);
 			}
 
-			if (ch <= 0x1F)
+			if (ch == ESC && (len = csi_fast(term, buf + i, size - i)) > 0)
+				i += len - 1;
+			else if (ch <= 0x1F)
 				control_character(term, ch);
 			else if (ch <= 0x7F)
 				addch(term, ch);
@@ -238,10 +357,33 @@ void parse(struct terminal *term, uint8_t *buf, int size)
 		else if (term->esc.state == STATE_OSC) {
 			if (push_esc(term, ch))
 				osc_sequence(term, ch);
+			else if (ch != ESC && !isdigit(ch) && term->esc.state == STATE_OSC)
+				osc_start(term);
 		}
 		else if (term->esc.state == STATE_DCS) {
 			if (push_esc(term, ch))
 				dcs_sequence(term, ch);
+			else if (ch == 'q' && dcs_header(term, ch))
+				sixel_start(term);
+			else if (ch == '{' && dcs_header(term, ch))
+				drcs_start(term);
+			else if ('@' <= ch && ch <= '~' && term->esc.state == STATE_DCS)
+				start_string(term, OSC_IGNORE); /* unsupported DCS: payload is discarded */
+		}
+		else if (term->esc.state == STATE_SIXEL) {
+			/* sixel data is decoded in place: never stored in esc.buf */
+			i += sixel_parse(term, buf + i, size - i) - 1;
+		}
+		else if (term->esc.state == STATE_DRCS) {
+			/* so is soft font */
+			i += drcs_parse(term, buf + i, size - i) - 1;
+		}
+		else if (term->esc.state == STATE_STR) {
+			/* and OSC payload (see osc.h) */
+			i += osc_parse(term, buf + i, size - i) - 1;
 		}
 	}
+
+	if (term->scrolling_off)
+		end_scroll_off(term);
 }
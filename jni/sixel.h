@@ -0,0 +1,393 @@
+/* See LICENSE for licence details. */
+/* sixel: DCS payload is decoded in place (not stored in esc.buf) into palette indexed image,
+	image is kept in slot of image store and each cell refers one cell sized tile of it */
+enum {
+	IMAGE_CELL       = 0x40000000, /* cell.code: IMAGE_CELL | slot << IMAGE_SLOT_SHIFT | tile */
+	IMAGE_SLOT_SHIFT = 20,
+	IMAGE_TILE_MASK  = 0xFFFFF,    /* tile: row * tile_cols + col */
+	SIXEL_UNSET      = SIXEL_COLORS, /* pixel not painted: cell background is shown */
+	SIXEL_BUFSIZE    = IMAGE_STORE_SIZE - sizeof(struct image_t), /* limit of decoded pixels (byte) */
+};
+
+/* VT340 default color registers (others are initialized by color_list[]) */
+const uint32_t sixel_default_color[] = {
+	0x000000, 0x3333CC, 0xCC2121, 0x33CC33, 0xCC33CC, 0x33CCCC, 0xCCCC33, 0x878787,
+	0x424242, 0x545499, 0x994242, 0x549954, 0x995499, 0x549999, 0x999954, 0xCCCCCC,
+};
+
+static inline int image_slot(uint32_t code)
+{
+	return (code & ~IMAGE_CELL) >> IMAGE_SLOT_SHIFT;
+}
+
+/* image store: images not referred by any cell are freed by gc */
+void image_free(struct image_store_t *store, int slot)
+{
+	struct image_t *ip = store->slot[slot];
+
+	store->bytes -= sizeof(struct image_t) + (size_t) ip->width * ip->height;
+	store->count--;
+	free(ip->pixels);
+	free(ip);
+	store->slot[slot] = NULL;
+}
+
+void image_gc(struct terminal *term)
+{
+	int i, freed = 0;
+	uint32_t code;
+	struct image_store_t *store = &term->image;
+
+	flush_scroll(term);
+	for (i = 0; i < term->cols * term->lines; i++) {
+		code = term->cells.code[i];
+		if (code >= IMAGE_CELL)
+			store->slot[image_slot(code)]->mark = true;
+	}
+
+	for (i = 0; i < IMAGE_SLOTS; i++) {
+		if (store->slot[i] == NULL)
+			continue;
+		else if (store->slot[i]->mark)
+			store->slot[i]->mark = false;
+		else {
+			image_free(store, i);
+			freed++;
+		}
+	}
+
+	if (freed > 0)
+		store->generation++;
+
+	if (DEBUG)
+		LOGE("image gc: %d images freed, %d images alive (%u bytes)\n",
+			freed, store->count, (unsigned) store->bytes);
+}
+
+/* image on screen is evicted: its cells become blank */
+void image_evict(struct terminal *term)
+{
+	int i, x, y, victim = -1;
+	uint32_t code;
+	struct image_store_t *store = &term->image;
+
+	for (i = 0; i < IMAGE_SLOTS; i++) {
+		if (store->slot[i] != NULL
+			&& (victim < 0 || store->slot[i]->used < store->slot[victim]->used))
+			victim = i;
+	}
+
+	flush_scroll(term);
+	for (y = 0; y < term->lines; y++) {
+		for (x = 0; x < term->cols; x++) {
+			code = term->cells.code[x + y * term->cols];
+			if (code >= IMAGE_CELL && image_slot(code) == victim)
+				erase_cell(term, y, x);
+		}
+	}
+
+	if (DEBUG)
+		LOGE("image evicted: slot:%d\n", victim);
+
+	image_free(store, victim);
+	store->generation++;
+}
+
+/* take pixels of decoder: return slot */
+int image_insert(struct terminal *term, struct sixel_t *sp)
+{
+	int slot;
+	size_t size;
+	struct image_t *ip;
+	struct image_store_t *store = &term->image;
+
+	size = sizeof(struct image_t) + (size_t) sp->width * sp->height;
+
+	if (store->count == IMAGE_SLOTS || store->bytes + size > IMAGE_STORE_SIZE)
+		image_gc(term);
+	while (store->count > 0
+		&& (store->count == IMAGE_SLOTS || store->bytes + size > IMAGE_STORE_SIZE))
+		image_evict(term);
+
+	for (slot = store->next; store->slot[slot] != NULL; slot = (slot + 1) % IMAGE_SLOTS);
+
+	ip = (struct image_t *) ecalloc(1, sizeof(struct image_t));
+	ip->pixels = sp->pixels;
+	ip->width  = sp->width;
+	ip->height = sp->height;
+	memcpy(ip->palette, sp->palette, sizeof(ip->palette));
+
+	store->slot[slot] = ip;
+	store->next   = (slot + 1) % IMAGE_SLOTS;
+	store->bytes += size;
+	store->count++;
+
+	return slot;
+}
+
+/* cells from cursor refer tiles of image (scroll if necessary): text continues at next line of image */
+void image_place(struct terminal *term, int slot)
+{
+	int row, col, rows, left, right;
+	struct cell_t cell;
+	struct image_t *ip = term->image.slot[slot];
+
+	/* tile size is fixed: image is resampled if cell size is changed later */
+	ip->tile_width  = term->font.width;
+	ip->tile_height = term->font.height;
+	ip->tile_cols   = my_ceil(ip->width, ip->tile_width);
+	ip->used        = term->image.clock++;
+
+	rows = my_ceil(ip->height, ip->tile_height);
+	if (rows * ip->tile_cols > IMAGE_TILE_MASK + 1)
+		rows = (IMAGE_TILE_MASK + 1) / ip->tile_cols;
+
+	if (DEBUG)
+		LOGE("image placed: slot:%d %dx%d pixels, %dx%d cells\n",
+			slot, ip->width, ip->height, ip->tile_cols, rows);
+
+	cell = blank_cell(term); /* background of unpainted pixels */
+
+	left  = term->cursor.x;
+	right = (left + ip->tile_cols < term->cols) ? left + ip->tile_cols - 1: term->cols - 1;
+	for (row = 0; row < rows; row++) {
+		if (row > 0)
+			move_cursor(term, 1, 0);
+		/* wide character cut by first or last column of row is erased as a whole */
+		fill_cells(term, term->cursor.y, left, right);
+		for (col = 0; col < ip->tile_cols && left + col < term->cols; col++) {
+			cell.code = IMAGE_CELL | (slot << IMAGE_SLOT_SHIFT) | (row * ip->tile_cols + col);
+			write_cell(term, term->cursor.y, left + col, &cell);
+		}
+		damage_cells(term, term->cursor.y, left, left + col - 1);
+	}
+	move_cursor(term, 1, 0);
+	term->wrap_occured = false;
+}
+
+/* decoder */
+static inline uint8_t sixel_percent(int value)
+{
+	value = (value > 100) ? 100: value;
+	return (value * 0xFF + 50) / 100;
+}
+
+/* DEC HLS: hue 0 is blue, 120 is red, 240 is green */
+uint32_t sixel_hls(int hue, int lum, int sat)
+{
+	int h, c, x, m, r, g, b;
+
+	lum = (lum > 100) ? 100: lum;
+	sat = (sat > 100) ? 100: sat;
+
+	h = (hue + 240) % 360;
+	c = (100 - abs(2 * lum - 100)) * sat / 100;
+	x = c * (60 - abs(h % 120 - 60)) / 60;
+	m = lum - c / 2;
+
+	r = g = b = 0;
+	switch (h / 60) {
+	case 0: r = c; g = x; break;
+	case 1: r = x; g = c; break;
+	case 2: g = c; b = x; break;
+	case 3: g = x; b = c; break;
+	case 4: r = x; b = c; break;
+	default: r = c; b = x; break;
+	}
+	return (sixel_percent(r + m) << 16) | (sixel_percent(g + m) << 8) | sixel_percent(b + m);
+}
+
+/* enlarge pixel buffer (clipped by SIXEL_MAX_SIZE and SIXEL_BUFSIZE) */
+void sixel_grow(struct sixel_t *sp, int width, int height)
+{
+	int y, stride, rows;
+	uint8_t *pixels;
+
+	if (width <= sp->stride && height <= sp->rows)
+		return;
+
+	stride = (width <= sp->stride) ? sp->stride: (width < sp->stride * 2) ? sp->stride * 2: width;
+	rows   = (height <= sp->rows) ? sp->rows: (height < sp->rows * 2) ? sp->rows * 2: height;
+
+	stride = (stride > SIXEL_MAX_SIZE) ? SIXEL_MAX_SIZE: stride;
+	rows   = (rows > SIXEL_MAX_SIZE) ? SIXEL_MAX_SIZE: rows;
+	if ((size_t) stride * rows > SIXEL_BUFSIZE)
+		rows = SIXEL_BUFSIZE / stride;
+
+	if (stride == sp->stride && rows == sp->rows) /* limit */
+		return;
+
+	pixels = (uint8_t *) ecalloc(stride, rows);
+	memset(pixels, SIXEL_UNSET, (size_t) stride * rows);
+	for (y = 0; y < sp->rows && y < rows; y++)
+		memcpy(pixels + y * stride, sp->pixels + y * sp->stride, sp->stride);
+	free(sp->pixels);
+
+	sp->pixels = pixels;
+	sp->stride = stride;
+	sp->rows   = rows;
+	sp->height = (sp->height > rows) ? rows: sp->height;
+}
+
+/* paint sixel (6 vertical pixels) count times */
+static inline void sixel_put(struct sixel_t *sp, int bits, int count)
+{
+	int i, n;
+
+	if (bits != 0) {
+		sixel_grow(sp, sp->x + count, sp->y + BITS_PER_SIXEL);
+		n = (sp->x + count > sp->stride) ? sp->stride - sp->x: count;
+
+		for (i = 0; i < BITS_PER_SIXEL && n > 0 && sp->y + i < sp->rows; i++) {
+			if (!(bits & (1 << i)))
+				continue;
+			memset(sp->pixels + sp->x + (sp->y + i) * sp->stride, sp->color, n);
+			if (sp->y + i >= sp->height)
+				sp->height = sp->y + i + 1;
+			if (sp->x + n > sp->width)
+				sp->width = sp->x + n;
+		}
+	}
+	sp->x = (sp->x + count > SIXEL_MAX_SIZE) ? SIXEL_MAX_SIZE: sp->x + count;
+}
+
+/* parameters of '!', '"', '#' are terminated: return repeat count */
+int sixel_command(struct sixel_t *sp)
+{
+	int *p = sp->param, repeat = 1;
+
+	if (sp->state == SIXEL_REPEAT) {
+		repeat = (p[0] > 0) ? p[0]: 1;
+	}
+	else if (sp->state == SIXEL_RASTER && sp->nparam >= 4 && p[2] > 0 && p[3] > 0) {
+		/* Pan;Pad;Ph;Pv: aspect ratio is ignored, image has at least Ph x Pv pixels */
+		sixel_grow(sp, p[2], p[3]);
+		if (p[2] > sp->width)
+			sp->width = (p[2] > sp->stride) ? sp->stride: p[2];
+		if (p[3] > sp->height)
+			sp->height = (p[3] > sp->rows) ? sp->rows: p[3];
+	}
+	else if (sp->state == SIXEL_COLOR) {
+		/* Pc: select color register, Pc;Pu;Px;Py;Pz: define it (Pu 1: HLS, 2: RGB percent) */
+		sp->color = p[0] % SIXEL_COLORS;
+		if (sp->nparam >= 5 && p[1] == 1)
+			sp->palette[sp->color] = sixel_hls(p[2], p[3], p[4]);
+		else if (sp->nparam >= 5 && p[1] == 2)
+			sp->palette[sp->color] = (sixel_percent(p[2]) << 16)
+				| (sixel_percent(p[3]) << 8) | sixel_percent(p[4]);
+	}
+
+	sp->state = SIXEL_DATA;
+	return repeat;
+}
+
+/* DCS P1;P2;P3 q (P2 is ignored: unpainted pixels always show cell background) */
+void sixel_start(struct terminal *term)
+{
+	int i;
+	struct sixel_t *sp = &term->sixel;
+
+	if (DEBUG)
+		LOGE("sixel: DCS %s\n", term->esc.buf + 1);
+
+	sp->pixels = NULL;
+	sp->stride = sp->rows = 0;
+	sp->width  = sp->height = 0;
+	sp->x = sp->y = 0;
+	sp->color  = 0;
+	sp->state  = SIXEL_DATA;
+	sp->esc    = false;
+
+	for (i = 0; i < SIXEL_COLORS; i++)
+		sp->palette[i] = (i < (int) (sizeof(sixel_default_color) / sizeof(uint32_t))) ?
+			sixel_default_color[i]: color_list[i];
+
+	term->esc.state = STATE_SIXEL;
+}
+
+void sixel_finish(struct terminal *term, bool cancel)
+{
+	int y;
+	struct sixel_t *sp = &term->sixel;
+
+	if (!cancel && sp->width > 0 && sp->height > 0) {
+		/* pack rows: stride becomes width */
+		for (y = 1; y < sp->height; y++)
+			memmove(sp->pixels + y * sp->width, sp->pixels + y * sp->stride, sp->width);
+		sp->pixels = (uint8_t *) erealloc(sp->pixels, (size_t) sp->width * sp->height);
+		image_place(term, image_insert(term, sp));
+	}
+	else
+		free(sp->pixels);
+
+	sp->pixels = NULL;
+	sp->stride = sp->rows = 0;
+	reset_esc(term);
+}
+
+/* decode sixel data until ST (or BEL): return number of consumed bytes */
+int sixel_parse(struct terminal *term, const uint8_t *buf, int size)
+{
+	int i, repeat;
+	uint8_t ch;
+	struct sixel_t *sp = &term->sixel;
+
+	for (i = 0; i < size; i++) {
+		ch = buf[i];
+
+		if (sp->esc) {
+			/* ESC '\' (ST) terminates image: other escape sequence interrupts it */
+			sp->esc = false;
+			sixel_finish(term, false);
+			if (ch == BACKSLASH)
+				return i + 1;
+			term->esc.state = STATE_ESC; /* ch is not consumed (may be 0 byte) */
+			return i;
+		}
+
+		if (sp->state != SIXEL_DATA) {
+			if ('0' <= ch && ch <= '9') {
+				sp->param[sp->nparam - 1] = sp->param[sp->nparam - 1] * 10 + (ch - '0');
+				if (sp->param[sp->nparam - 1] > SIXEL_MAX_SIZE)
+					sp->param[sp->nparam - 1] = SIXEL_MAX_SIZE;
+				continue;
+			}
+			else if (ch == ';') {
+				if (sp->nparam < MAX_ARGS)
+					sp->param[sp->nparam++] = 0;
+				continue;
+			}
+		}
+
+		repeat = (sp->state != SIXEL_DATA) ? sixel_command(sp): 1;
+
+		if ('?' <= ch && ch <= '~') {
+			sixel_put(sp, ch - '?', repeat);
+		}
+		else if (ch == '!' || ch == '"' || ch == '#') {
+			sp->state = (ch == '!') ? SIXEL_REPEAT: (ch == '"') ? SIXEL_RASTER: SIXEL_COLOR;
+			sp->param[0] = 0;
+			sp->nparam   = 1;
+		}
+		else if (ch == '$') { /* graphics carriage return */
+			sp->x = 0;
+		}
+		else if (ch == '-') { /* graphics new line */
+			sp->x = 0;
+			sp->y = (sp->y + BITS_PER_SIXEL > SIXEL_MAX_SIZE) ? SIXEL_MAX_SIZE: sp->y + BITS_PER_SIXEL;
+		}
+		else if (ch == ESC) {
+			sp->esc = true;
+		}
+		else if (ch == BEL) {
+			sixel_finish(term, false);
+			return i + 1;
+		}
+		else if (ch == CAN || ch == SUB) {
+			sixel_finish(term, true);
+			return i + 1;
+		}
+		/* others (CR, LF...) are ignored */
+	}
+	return size;
+}
@@ -1,104 +1,831 @@
 /* See LICENSE for licence details. */
-void erase_cell(struct terminal *term, int y, int x)
+/* damage tracking: damaged lines are in dirty bitset, and each of them keeps one dirty column range */
+static inline void damage_cells(struct terminal *term, int y, int first, int last)
+{
+	struct damage_t *dp = &term->damage[y];
+
+	if (!bit_test(term->dirty, y)) {
+		bit_set(term->dirty, y);
+		dp->first = first;
+		dp->last  = last;
+		return;
+	}
+	if (first < dp->first)
+		dp->first = first;
+	if (last > dp->last)
+		dp->last = last;
+}
+
+static inline void damage_line(struct terminal *term, int y)
+{
+	bit_set(term->dirty, y);
+	term->damage[y].first = 0;
+	term->damage[y].last  = term->cols - 1;
+}
+
+static inline void clear_damage(struct terminal *term, int y)
+{
+	bit_clear(term->dirty, y);
+}
+
+static inline bool is_damaged(struct terminal *term, int y)
+{
+	return bit_test(term->dirty, y);
+}
+
+/* iterate damaged lines: for (y = next_damaged(term, 0); y < term->lines; y = next_damaged(term, y + 1)) */
+static inline int next_damaged(struct terminal *term, int y)
+{
+	return bit_next(term->dirty, y, term->lines);
+}
+
+/* tabstop at every TABSTOP columns from first (bits above cols are cleared) */
+static inline void reset_tabstop(struct terminal *term, int first)
+{
+	int x;
+
+	bit_fill(term->tabstop, first, my_ceil(term->cols, BITS_PER_WORD) * BITS_PER_WORD - 1, false);
+	for (x = my_ceil(first, TABSTOP) * TABSTOP; x < term->cols; x += TABSTOP)
+		bit_set(term->tabstop, x);
+}
+
+/* grid: each field of cells is a plane, so loops over one field (fill, scan, move) read only that field
+	grid_at() gives view of planes from cell index (line: y * cols), other helpers index that view */
+static inline struct grid_t grid_at(const struct grid_t *grid, int index)
+{
+	struct grid_t view = { grid->code + index, grid->style + index, grid->width + index };
+
+	return view;
+}
+
+static inline struct cell_t grid_cell(const struct grid_t *grid, int i)
+{
+	struct cell_t cell = { grid->code[i], grid->style[i], grid->width[i] };
+
+	return cell;
+}
+
+static inline void grid_put(struct grid_t *grid, int i, const struct cell_t *cellp)
+{
+	grid->code[i]  = cellp->code;
+	grid->style[i] = cellp->style;
+	grid->width[i] = cellp->width;
+}
+
+/* n cells from i become cellp: plain loops are vectorized by compiler */
+static inline void grid_fill(struct grid_t *grid, int i, int n, const struct cell_t *cellp)
+{
+	int j;
+
+	for (j = i; j < i + n; j++)
+		grid->code[j] = cellp->code;
+	for (j = i; j < i + n; j++)
+		grid->style[j] = cellp->style;
+	memset(grid->width + i, cellp->width, n);
+}
+
+/* n cells from src[si] to dst[di] (may overlap) */
+static inline void grid_move(struct grid_t *dst, int di, const struct grid_t *src, int si, int n)
+{
+	memmove(dst->code + di, src->code + si, n * sizeof(uint32_t));
+	memmove(dst->style + di, src->style + si, n * sizeof(uint16_t));
+	memmove(dst->width + di, src->width + si, n * sizeof(uint8_t));
+}
+
+void grid_alloc(struct grid_t *grid, int size)
+{
+	grid->code  = (uint32_t *) ecalloc(size, sizeof(uint32_t));
+	grid->style = (uint16_t *) ecalloc(size, sizeof(uint16_t));
+	grid->width = (uint8_t *) ecalloc(size, sizeof(uint8_t));
+}
+
+void grid_free(struct grid_t *grid)
+{
+	free(grid->code);
+	free(grid->style);
+	free(grid->width);
+}
+
+static inline uint64_t palette_version(struct terminal *term, uint16_t color)
+{
+	return (color < COLORS) ? term->palette_version[color]: 0;
+}
+
+/* colors that cell is drawn with: bold/blink brighten color 0-7, and reverse swaps fg/bg
+	(reverse screen is applied by renderer: it never changes which color index is used) */
+static inline struct color_pair_t style_color(struct color_pair_t color_pair, uint8_t attribute)
+{
+	uint16_t color_tmp;
+
+	if (BOLD_IS_BRIGHT && (attribute & attr_mask[ATTR_BOLD]) && color_pair.fg <= 7)
+		color_pair.fg += BRIGHT_INC;
+	if ((attribute & attr_mask[ATTR_BLINK]) && color_pair.bg <= 7)
+		color_pair.bg += BRIGHT_INC;
+
+	if (attribute & attr_mask[ATTR_REVERSE]) {
+		color_tmp     = color_pair.fg;
+		color_pair.fg = color_pair.bg;
+		color_pair.bg = color_tmp;
+	}
+	return color_pair;
+}
+
+/* style table: (color pair, attribute) are interned, cells refer them by 16bit style
+	usage count of each style follows cells (written, erased, scrolled out), and styles that
+	no cell refers are freed when table is full (see style_gc()) */
+static inline struct style_t *cell_style(struct terminal *term, uint16_t style)
+{
+	return &term->style.entry[style];
+}
+
+static inline uint64_t style_key(struct color_pair_t color_pair, uint8_t attribute)
+{
+	return (uint64_t) color_pair.fg | ((uint64_t) color_pair.bg << 16) | ((uint64_t) attribute << 32);
+}
+
+static inline int style_bucket(struct style_table_t *st, uint64_t key)
+{
+	return mix64(key) & (st->size * 2 - 1); /* open addressing */
+}
+
+static inline void style_insert(struct style_table_t *st, int style)
+{
+	int b;
+	struct style_t *sp = &st->entry[style];
+
+	for (b = style_bucket(st, style_key(sp->color_pair, sp->attribute)); st->bucket[b]; b = (b + 1) & (st->size * 2 - 1));
+	st->bucket[b] = style + 1;
+}
+
+/* sweep: free styles not referred by any cell (style 0, current pen and erased cell style are kept),
+	then table is doubled if it is still more than half full */
+void style_gc(struct terminal *term)
+{
+	int i;
+	struct style_t *sp;
+	struct style_table_t *st = &term->style;
+
+	st->count = 0;
+	for (i = 0; i < st->size; i++) {
+		sp = &st->entry[i];
+		if (sp->used && (sp->cells > 0 || i == 0 || i == st->pen || i == st->blank))
+			st->count++;
+		else
+			sp->used = false;
+	}
+
+	if (st->count > st->size / 2 && st->size < MAX_STYLES) {
+		st->entry = (struct style_t *) erealloc(st->entry, st->size * 2 * sizeof(struct style_t));
+		memset(st->entry + st->size, 0, st->size * sizeof(struct style_t));
+		st->next  = st->size;
+		st->size *= 2;
+		free(st->bucket);
+		st->bucket = (uint32_t *) ecalloc(st->size * 2, sizeof(uint32_t));
+	}
+	else
+		memset(st->bucket, 0, st->size * 2 * sizeof(uint32_t));
+
+	for (i = 0; i < st->size; i++) {
+		if (st->entry[i].used)
+			style_insert(st, i);
+	}
+	st->generation++;
+
+	if (DEBUG)
+		LOGE("style gc: %d/%d entries alive\n", st->count, st->size);
+}
+
+uint16_t style_index(struct terminal *term, struct color_pair_t color_pair, uint8_t attribute)
+{
+	int i, b;
+	uint64_t key = style_key(color_pair, attribute);
+	struct style_t *sp;
+	struct style_table_t *st = &term->style;
+
+	for (b = style_bucket(st, key); st->bucket[b]; b = (b + 1) & (st->size * 2 - 1)) {
+		sp = &st->entry[st->bucket[b] - 1];
+		if (style_key(sp->color_pair, sp->attribute) == key)
+			return st->bucket[b] - 1;
+	}
+
+	if (st->count == st->size) {
+		style_gc(term);
+		if (st->count == st->size) /* all styles are on screen */
+			return 0;
+		for (b = style_bucket(st, key); st->bucket[b]; b = (b + 1) & (st->size * 2 - 1));
+	}
+
+	for (i = st->next; st->entry[i].used; i = (i + 1) % st->size);
+	sp = &st->entry[i];
+	sp->color_pair = color_pair;
+	sp->color      = style_color(color_pair, attribute);
+	sp->attribute  = attribute;
+	sp->cells      = 0;
+	sp->used       = true;
+	st->bucket[b]  = i + 1;
+	st->next       = (i + 1) % st->size;
+	st->count++;
+
+	return i;
+}
+
+/* style of cell written with current colors: last one is reused while colors and attribute are same
+	(pen: term->style.pen with term->attribute, bce: term->style.blank with ATTR_RESET) */
+static inline uint16_t pen_style(struct terminal *term, uint16_t *style, uint8_t attribute)
+{
+	const struct style_t *sp = &term->style.entry[*style];
+
+	if (!sp->used || sp->attribute != attribute
+		|| sp->color_pair.fg != term->color_pair.fg || sp->color_pair.bg != term->color_pair.bg)
+		*style = style_index(term, term->color_pair, attribute);
+	return *style;
+}
+
+/* line hash: sum of per cell hashes, updated whenever a cell is written */
+static inline uint64_t cell_hash(struct terminal *term, uint32_t code, uint16_t style, uint8_t width, int x)
+{
+	uint64_t key, version;
+	const struct style_t *sp = cell_style(term, style);
+
+	/* code: code point or image tile (32bit), colors are hashed by value (style may be reused) */
+	key = (uint64_t) code
+		| ((uint64_t) sp->color_pair.fg << 32) | ((uint64_t) sp->color_pair.bg << 48);
+
+	/* redefined color index gives other hash */
+	version = (palette_version(term, sp->color.fg) << 24)
+		^ (palette_version(term, sp->color.bg) << 40);
+
+	/* mix column: same content at other column gives other hash */
+	return mix64(key ^ ((((uint64_t) x << 8) | (sp->attribute << 2) | width | version)
+		* 0x9E3779B97F4A7C15ULL));
+}
+
+static inline uint64_t grid_hash(struct terminal *term, const struct grid_t *line, int x)
+{
+	return cell_hash(term, line->code[x], line->style[x], line->width[x], x);
+}
+
+/* usage count of style that cells refer */
+static inline void count_style(struct terminal *term, uint16_t style, int n)
 {
-	struct cell_t *cellp;
+	term->style.entry[style].cells += n;
+}
+
+/* number of cell fg/bg that are drawn with color index (interned truecolor is not counted) */
+static inline int color_used(struct terminal *term, int index)
+{
+	int i, n = 0;
+	struct style_t *sp;
+
+	for (i = 0; i < term->style.size; i++) {
+		sp = &term->style.entry[i];
+		if (sp->used && sp->cells > 0)
+			n += sp->cells * ((sp->color.fg == index) + (sp->color.bg == index));
+	}
+	return n;
+}
 
-	cellp             = &term->cells[x + y * term->cols];
-	cellp->glyphp     = term->glyph_map[DEFAULT_CHAR];
-	cellp->color_pair = term->color_pair; /* bce */
-	cellp->attribute  = ATTR_RESET;
-	cellp->width      = HALF;
+static inline void count_line(struct terminal *term, int y, int n)
+{
+	int x;
+	const uint16_t *style = term->cells.style + y * term->cols;
 
-	term->line_dirty[y] = true;
+	for (x = 0; x < term->cols; x++)
+		count_style(term, style[x], n);
 }
 
-void copy_cell(struct terminal *term, int dst_y, int dst_x, int src_y, int src_x)
+/* deferred scroll: return index of pending.cells if line y was scrolled in, or -1 */
+static inline int pending_line(struct terminal *term, int y)
 {
-	struct cell_t *dst, *src;
+	struct scroll_t *sp = &term->pending;
+
+	if (sp->offset > 0 && y > sp->to - sp->offset && y <= sp->to)
+		return y - (sp->to - sp->offset + 1);
+	else if (sp->offset < 0 && y >= sp->from && y < sp->from - sp->offset)
+		return (sp->from - sp->offset - 1) - y; /* newest line has largest index */
+	return -1;
+}
 
-	dst = &term->cells[dst_x + dst_y * term->cols];
-	src = &term->cells[src_x + src_y * term->cols];
+/* apply pending scroll: region is moved once, then lines scrolled in are copied */
+void flush_scroll(struct terminal *term)
+{
+	int i, n, moved, region;
+	struct scroll_t *sp = &term->pending;
 
-	if (src->width == NEXT_TO_WIDE)
+	if (sp->offset == 0)
 		return;
-	else if (src->width == WIDE && dst_x == (term->cols - 1))
-		erase_cell(term, dst_y, dst_x);
+
+	n      = abs(sp->offset);
+	moved  = (sp->to - sp->from + 1) - n;
+	region = sp->from * term->cols;
+
+	if (sp->offset > 0) {
+		grid_move(&term->cells, region, &term->cells, region + n * term->cols, moved * term->cols);
+		memmove(term->line_hash + sp->from, term->line_hash + sp->from + n, sizeof(uint64_t) * moved);
+		grid_move(&term->cells, region + moved * term->cols, &sp->cells, 0, n * term->cols);
+		memcpy(term->line_hash + sp->from + moved, sp->line_hash, sizeof(uint64_t) * n);
+	}
 	else {
-		*dst = *src;
-		if (src->width == WIDE) {
-			*(dst + 1) = *src;
-			(dst + 1)->width = NEXT_TO_WIDE;
+		grid_move(&term->cells, region + n * term->cols, &term->cells, region, moved * term->cols);
+		memmove(term->line_hash + sp->from + n, term->line_hash + sp->from, sizeof(uint64_t) * moved);
+		for (i = 0; i < n; i++) {
+			grid_move(&term->cells, region + (n - 1 - i) * term->cols, &sp->cells, i * term->cols, term->cols);
+			term->line_hash[sp->from + n - 1 - i] = sp->line_hash[i];
+		}
+	}
+	sp->offset = 0;
+}
+
+/* cells and hash of line y: line scrolled in by pending scroll is in pending.cells */
+static inline struct grid_t line_cells(struct terminal *term, int y, uint64_t **hash)
+{
+	int line;
+
+	if (term->pending.offset != 0 && term->pending.from <= y && y <= term->pending.to) {
+		if ((line = pending_line(term, y)) >= 0) {
+			*hash = &term->pending.line_hash[line];
+			return grid_at(&term->pending.cells, line * term->cols);
 		}
-		term->line_dirty[dst_y] = true;
+		flush_scroll(term); /* line is moved by pending scroll */
 	}
+	*hash = &term->line_hash[y];
+	return grid_at(&term->cells, y * term->cols);
 }
 
-int set_cell(struct terminal *term, int y, int x, const struct glyph_t *glyphp)
+static inline void write_cell(struct terminal *term, int y, int x, const struct cell_t *cellp)
 {
-	struct cell_t cell, *cellp;
-	uint8_t color_tmp;
+	uint64_t *hash;
+	struct grid_t line = line_cells(term, y, &hash);
 
-	cell.glyphp = glyphp;
+	*hash += cell_hash(term, cellp->code, cellp->style, cellp->width, x) - grid_hash(term, &line, x);
+	count_style(term, line.style[x], -1);
+	count_style(term, cellp->style, 1);
+	grid_put(&line, x, cellp);
+}
+
+void rehash_line(struct terminal *term, int y)
+{
+	int x;
+	struct grid_t line;
+
+	flush_scroll(term);
+	line = grid_at(&term->cells, y * term->cols);
+	term->line_hash[y] = 0;
+	for (x = 0; x < term->cols; x++)
+		term->line_hash[y] += grid_hash(term, &line, x);
+}
+
+/* cells are replaced without write_cell() */
+void recount_styles(struct terminal *term)
+{
+	int i, y;
+
+	flush_scroll(term);
+	for (i = 0; i < term->style.size; i++)
+		term->style.entry[i].cells = 0;
+	for (y = 0; y < term->lines; y++)
+		count_line(term, y, 1);
+}
+
+/* only lines that use color index are hashed again and damaged (found by usage count) */
+void set_palette(struct terminal *term, int index, uint32_t rgb)
+{
+	int x, y, n, used, found = 0;
+	struct style_t *sp;
+
+	if (term->palette[index] == rgb)
+		return;
+
+	flush_scroll(term);
+	term->palette[index] = rgb;
+	term->palette_version[index] = ++term->palette_generation;
+
+	used = color_used(term, index);
+	for (y = 0; y < term->lines && found < used; y++) {
+		for (n = 0, x = 0; x < term->cols; x++) {
+			sp = cell_style(term, term->cells.style[x + y * term->cols]);
+			n += (sp->color.fg == index) + (sp->color.bg == index);
+		}
+		if (n > 0) {
+			rehash_line(term, y);
+			damage_line(term, y);
+			found += n;
+		}
+	}
+}
+
+static inline struct cell_t blank_cell(struct terminal *term)
+{
+	struct cell_t cell;
 
-	cell.color_pair.fg = (term->attribute & attr_mask[ATTR_BOLD] && term->color_pair.fg <= 7) ?
-		term->color_pair.fg + BRIGHT_INC: term->color_pair.fg;
-	cell.color_pair.bg = (term->attribute & attr_mask[ATTR_BLINK] && term->color_pair.bg <= 7) ?
-		term->color_pair.bg + BRIGHT_INC: term->color_pair.bg;
+	cell.code  = DEFAULT_CHAR;
+	cell.style = pen_style(term, &term->style.blank, ATTR_RESET); /* bce */
+	cell.width = HALF;
 
-	if (term->attribute & attr_mask[ATTR_REVERSE]) {
-		color_tmp          = cell.color_pair.fg;
-		cell.color_pair.fg = cell.color_pair.bg;
-		cell.color_pair.bg = color_tmp;
+	return cell;
+}
+
+/* hash of blank cells [first, last]: prefix sum is kept while blank and palette are same
+	(ED, EL and scroll fill many ranges with same blank) */
+static inline uint64_t blank_hash(struct terminal *term, const struct cell_t *blank, int first, int last)
+{
+	int x;
+	struct blank_hash_t *bp = &term->blank_hash;
+
+	if (bp->style != blank->style || bp->cols != term->cols
+		|| bp->palette_generation != term->palette_generation
+		|| bp->style_generation != term->style.generation) {
+		if (bp->cols != term->cols)
+			bp->sum = (uint64_t *) erealloc(bp->sum, (term->cols + 1) * sizeof(uint64_t));
+		bp->sum[0] = 0;
+		for (x = 0; x < term->cols; x++)
+			bp->sum[x + 1] = bp->sum[x] + cell_hash(term, blank->code, blank->style, blank->width, x);
+		bp->style = blank->style;
+		bp->cols  = term->cols;
+		bp->palette_generation = term->palette_generation;
+		bp->style_generation   = term->style.generation;
+	}
+	return bp->sum[last + 1] - bp->sum[first];
+}
+
+/* row primitive: cells [first, last] of line y become blank (bce)
+	wide character cut by the range is erased as a whole */
+void fill_cells(struct terminal *term, int y, int first, int last)
+{
+	int x;
+	uint64_t *hash, sum = 0;
+	struct cell_t blank;
+	struct grid_t line = line_cells(term, y, &hash);
+
+	if (first > last)
+		return;
+
+	if (first > 0 && line.width[first] == NEXT_TO_WIDE)
+		first--;
+	if (last < term->cols - 1 && line.width[last] == WIDE)
+		last++;
+
+	/* whole line: old hash is not needed */
+	if (first == 0 && last == term->cols - 1) {
+		for (x = first; x <= last; x++)
+			count_style(term, line.style[x], -1);
 	}
+	else {
+		for (x = first; x <= last; x++) {
+			sum += grid_hash(term, &line, x);
+			count_style(term, line.style[x], -1);
+		}
+		sum = *hash - sum;
+	}
+
+	blank = blank_cell(term);
+	*hash = sum + blank_hash(term, &blank, first, last);
+	grid_fill(&line, first, last - first + 1, &blank);
+	count_style(term, blank.style, last - first + 1);
+
+	damage_cells(term, y, first, last);
+}
+
+void erase_cell(struct terminal *term, int y, int x)
+{
+	fill_cells(term, y, x, x);
+}
+
+/* row primitive: move n cells of line y from src to dst (source cells out of dst are left as they are)
+	wide character cut by dst range or by moved range becomes blank */
+void move_cells(struct terminal *term, int y, int dst, int src, int n)
+{
+	int x, first, last;
+	uint64_t *hash;
+	struct cell_t blank;
+	struct grid_t line = line_cells(term, y, &hash);
+
+	if (n <= 0)
+		return;
+
+	first = (dst > 0 && line.width[dst] == NEXT_TO_WIDE) ? dst - 1: dst;
+	last  = (dst + n < term->cols && line.width[dst + n - 1] == WIDE) ? dst + n: dst + n - 1;
+
+	for (x = first; x <= last; x++)
+		count_style(term, line.style[x], -1);
+
+	grid_move(&line, dst, &line, src, n);
+
+	blank = blank_cell(term);
+	if (first < dst)
+		grid_put(&line, first, &blank);
+	if (last >= dst + n)
+		grid_put(&line, last, &blank);
+	if (line.width[dst] == NEXT_TO_WIDE)
+		grid_put(&line, dst, &blank);
+	if (line.width[dst + n - 1] == WIDE)
+		grid_put(&line, dst + n - 1, &blank);
+
+	for (x = first; x <= last; x++)
+		count_style(term, line.style[x], 1);
 
-	cell.attribute  = term->attribute;
-	cell.width      = glyphp->width;
+	/* cell hash depends on column */
+	*hash = 0;
+	for (x = 0; x < term->cols; x++)
+		*hash += grid_hash(term, &line, x);
 
-	cellp    = &term->cells[x + y * term->cols];
-	*cellp   = cell;
-	term->line_dirty[y] = true;
+	damage_cells(term, y, first, last);
+}
+
+int set_cell(struct terminal *term, int y, int x, uint32_t code)
+{
+	struct cell_t cell;
+
+	cell.code  = code;
+	cell.style = pen_style(term, &term->style.pen, term->attribute);
+	cell.width = glyph_width(&term->font, code);
+
+	write_cell(term, y, x, &cell);
 
 	if (cell.width == WIDE && x + 1 < term->cols) {
-		cellp        = &term->cells[x + 1 + y * term->cols];
-		*cellp       = cell;
-		cellp->width = NEXT_TO_WIDE;
+		cell.width = NEXT_TO_WIDE;
+		write_cell(term, y, x + 1, &cell);
+		damage_cells(term, y, x, x + 1);
 		return WIDE;
 	}
+	damage_cells(term, y, x, x);
 	return HALF;
 }
 
+/* combining characters: cell of base character with its marks refers entry of arena
+	by COMBINED_CELL | offset (cell of single code point never uses arena) */
+enum {
+	COMBINED_CELL = 0x20000000, /* cell.code: COMBINED_CELL | offset (below IMAGE_CELL) */
+	COMBINED_MASK = MAX_COMBINING_ARENA - 1,
+};
+
+static inline bool is_combined(uint32_t code)
+{
+	return (code & ~COMBINED_MASK) == COMBINED_CELL;
+}
+
+/* compaction: entries referred by cells are copied to new arena (entries of cells overwritten by
+	scroll or erase are dropped), and lines whose cells have new offset are hashed again */
+void combining_compact(struct terminal *term)
+{
+	int x, y, n, offset, used = 0;
+	uint32_t *code, *arena;
+	bool moved;
+	struct combining_t *cp = &term->combining;
+
+	flush_scroll(term);
+	arena = (uint32_t *) ecalloc(cp->size, sizeof(uint32_t));
+
+	for (y = 0; y < term->lines; y++) {
+		moved = false;
+		for (x = 0; x < term->cols; x++) {
+			code = &term->cells.code[x + y * term->cols];
+			if (!is_combined(*code))
+				continue;
+
+			/* first cell that refers entry copies it: base code is replaced by new offset
+				(right half of wide cell and other cells of same entry follow it) */
+			offset = *code & COMBINED_MASK;
+			if (!is_combined(cp->code[offset])) {
+				n = cp->code[offset + 1] + 2;
+				memcpy(arena + used, cp->code + offset, n * sizeof(uint32_t));
+				cp->code[offset] = COMBINED_CELL | used;
+				used += n;
+			}
+			if (*code != cp->code[offset]) {
+				*code = cp->code[offset];
+				moved = true;
+			}
+		}
+		if (moved) {
+			rehash_line(term, y);
+			damage_line(term, y);
+		}
+	}
+
+	free(cp->code);
+	cp->code = arena;
+	cp->used = used;
+	cp->generation++;
+
+	if (DEBUG)
+		LOGE("combining compaction: %d code points alive\n", used);
+}
+
+/* n code points at end of arena: arena is compacted when full (and doubled if still half full), or -1 */
+static inline int combining_alloc(struct terminal *term, int n)
+{
+	struct combining_t *cp = &term->combining;
+
+	if (cp->used + n > cp->size) {
+		combining_compact(term);
+		if (cp->used + n > cp->size / 2 && cp->size < MAX_COMBINING_ARENA) {
+			cp->size *= 2;
+			cp->code  = (uint32_t *) erealloc(cp->code, cp->size * sizeof(uint32_t));
+		}
+		if (cp->used + n > cp->size)
+			return -1;
+	}
+	cp->used += n;
+	return cp->used - n;
+}
+
+/* zero width character is attached to cell written by last addch() (see last_cell):
+	new entry (old marks and code appended) is written to cell, and to right half of wide cell */
+void combine_char(struct terminal *term, uint32_t code)
+{
+	int x, y, marks, offset;
+	uint32_t base, mark[MAX_COMBINING], *entry;
+	uint64_t *hash;
+	struct cell_t cell;
+	struct grid_t line;
+
+	if (!term->has_last_cell) /* cursor was moved after last written cell */
+		return;
+	y = term->last_cell.y;
+	x = term->last_cell.x;
+
+	line = line_cells(term, y, &hash);
+	cell = grid_cell(&line, x);
+
+	if (is_combined(cell.code)) {
+		entry = &term->combining.code[cell.code & COMBINED_MASK];
+		base  = entry[0];
+		marks = entry[1];
+		if (marks == MAX_COMBINING)
+			return;
+		memcpy(mark, entry + 2, marks * sizeof(uint32_t));
+	}
+	else if (cell.code < GLYPHS) {
+		base  = cell.code;
+		marks = 0;
+	}
+	else /* image tile */
+		return;
+	mark[marks++] = code;
+
+	if ((offset = combining_alloc(term, marks + 2)) < 0)
+		return;
+	entry = &term->combining.code[offset];
+	entry[0] = base;
+	entry[1] = marks;
+	memcpy(entry + 2, mark, marks * sizeof(uint32_t));
+
+	cell.code = COMBINED_CELL | offset;
+	write_cell(term, y, x, &cell);
+	if (cell.width == WIDE && x + 1 < term->cols) {
+		cell.width = NEXT_TO_WIDE;
+		write_cell(term, y, x + 1, &cell);
+		damage_cells(term, y, x, x + 1);
+	}
+	else
+		damage_cells(term, y, x, x);
+}
+
+/* truecolor: 24bit colors are interned, cells refer them by index (COLORS + entry) */
+enum {
+	TRUECOLOR_USED    = 0x1000000,      /* flags of rgb[] entry */
+	TRUECOLOR_MARK    = 0x2000000,
+	TRUECOLOR_BUCKETS = TRUECOLORS * 2, /* open addressing */
+};
+
+/* nearest index of current palette (OSC 4 may change it) */
+uint8_t nearest_color(const uint32_t *palette, uint32_t rgb)
+{
+	int i, dr, dg, db;
+	uint8_t index = 0;
+	uint32_t dist, min = UINT32_MAX;
+
+	for (i = 0; i < COLORS; i++) {
+		dr = (int) ((rgb >> 16) & 0xFF) - (int) ((palette[i] >> 16) & 0xFF);
+		dg = (int) ((rgb >> 8) & 0xFF) - (int) ((palette[i] >> 8) & 0xFF);
+		db = (int) (rgb & 0xFF) - (int) (palette[i] & 0xFF);
+
+		dist = dr * dr + dg * dg + db * db;
+		if (dist < min) {
+			min   = dist;
+			index = i;
+		}
+	}
+	return index;
+}
+
+static inline int truecolor_bucket(uint32_t rgb)
+{
+	return mix64(rgb) & (TRUECOLOR_BUCKETS - 1);
+}
+
+static inline void truecolor_mark(struct truecolor_t *tc, uint16_t color)
+{
+	if (color >= COLORS)
+		tc->rgb[color - COLORS] |= TRUECOLOR_MARK;
+}
+
+/* mark and sweep: free entries not referred by any cell */
+void truecolor_gc(struct terminal *term)
+{
+	int i, b;
+	struct style_t *sp;
+	struct truecolor_t *tc = &term->truecolor;
+
+	/* colors of styles that cells refer (lines scrolled in by pending scroll are counted too) */
+	truecolor_mark(tc, term->color_pair.fg);
+	truecolor_mark(tc, term->color_pair.bg);
+	for (i = 0; i < term->style.size; i++) {
+		sp = &term->style.entry[i];
+		if (sp->used && sp->cells > 0) {
+			truecolor_mark(tc, sp->color_pair.fg);
+			truecolor_mark(tc, sp->color_pair.bg);
+		}
+	}
+
+	tc->count = 0;
+	memset(tc->bucket, 0, TRUECOLOR_BUCKETS * sizeof(uint16_t));
+	for (i = 0; i < TRUECOLORS; i++) {
+		if (!(tc->rgb[i] & TRUECOLOR_MARK)) {
+			tc->rgb[i] = 0;
+			continue;
+		}
+		tc->rgb[i] &= ~TRUECOLOR_MARK;
+		for (b = truecolor_bucket(tc->rgb[i] & 0xFFFFFF); tc->bucket[b]; b = (b + 1) & (TRUECOLOR_BUCKETS - 1));
+		tc->bucket[b] = i + 1;
+		tc->count++;
+	}
+	tc->generation++;
+
+	if (DEBUG)
+		LOGE("truecolor gc: %d entries alive\n", tc->count);
+}
+
+uint16_t truecolor_index(struct terminal *term, uint32_t rgb)
+{
+	int i, b;
+	struct truecolor_t *tc = &term->truecolor;
+
+	for (b = truecolor_bucket(rgb); tc->bucket[b]; b = (b + 1) & (TRUECOLOR_BUCKETS - 1))
+		if (tc->rgb[tc->bucket[b] - 1] == (rgb | TRUECOLOR_USED))
+			return COLORS + tc->bucket[b] - 1;
+
+	if (tc->count == TRUECOLORS) {
+		truecolor_gc(term);
+		if (tc->count == TRUECOLORS) /* all colors are on screen */
+			return nearest_color(term->palette, rgb);
+		for (b = truecolor_bucket(rgb); tc->bucket[b]; b = (b + 1) & (TRUECOLOR_BUCKETS - 1));
+	}
+
+	for (i = tc->next; tc->rgb[i] & TRUECOLOR_USED; i = (i + 1) % TRUECOLORS);
+	tc->rgb[i]    = rgb | TRUECOLOR_USED;
+	tc->bucket[b] = i + 1;
+	tc->next      = (i + 1) % TRUECOLORS;
+	tc->count++;
+
+	return COLORS + i;
+}
+
+/* scroll is deferred: consecutive scrolls of same region and direction are applied by one move
+	(flush_scroll() is called before cells of moved lines are accessed, and at refresh) */
 void scroll(struct terminal *term, int from, int to, int offset)
 {
-	int i, j, size, abs_offset;
-	struct cell_t *dst, *src;
+	int i, n, height, pending;
+	uint64_t hash;
+	struct cell_t blank;
+	struct scroll_t *sp = &term->pending;
 
-	if (offset == 0 || from >= to)
+	if (offset == 0 || from >= to || term->scrolling_off)
 		return;
+	term->has_last_cell = false; /* last written cell is moved */
 
 	if (DEBUG)
 		LOGE("scroll from:%d to:%d offset:%d\n", from, to, offset);
 
 	for (i = from; i <= to; i++)
-		term->line_dirty[i] = true;
+		damage_line(term, i);
 
-	abs_offset = abs(offset);
-	size = sizeof(struct cell_t) * ((to - from + 1) - abs_offset) * term->cols;
+	/* offset larger than region only clears region */
+	height = to - from + 1;
+	n = (abs(offset) < height) ? abs(offset): height;
 
-	dst = term->cells + from * term->cols;
-	src = term->cells + (from + abs_offset) * term->cols;
+	if (sp->offset != 0 && (sp->from != from || sp->to != to
+		|| (sp->offset > 0) != (offset > 0) || abs(sp->offset) + n > height))
+		flush_scroll(term);
 
-	if (offset > 0) {
-		memmove(dst, src, size);
-		for (i = (to - offset + 1); i <= to; i++)
-			for (j = 0; j < term->cols; j++)
-				erase_cell(term, i, j);
-	}
-	else {
-		memmove(src, dst, size);
-		for (i = from; i < from + abs_offset; i++)
-			for (j = 0; j < term->cols; j++)
-				erase_cell(term, i, j);
-	}
+	sp->from = from;
+	sp->to   = to;
+	pending  = abs(sp->offset);
+
+	/* lines scrolled out are still in cells (not yet moved): forget usage of their colors */
+	for (i = 0; i < n; i++)
+		count_line(term, (offset > 0) ? from + pending + i: to - pending - i, -1);
+
+	/* lines scrolled in are blank (bce) */
+	blank = blank_cell(term);
+	hash  = blank_hash(term, &blank, 0, term->cols - 1);
+
+	grid_fill(&sp->cells, pending * term->cols, n * term->cols, &blank);
+	count_style(term, blank.style, n * term->cols);
+	for (i = pending; i < pending + n; i++)
+		sp->line_hash[i] = hash;
+	sp->offset += (offset > 0) ? n: -n;
 }
 
 /* relative movement: cause scrolling */
@@ -106,6 +833,8 @@ void move_cursor(struct terminal *term, int y_offset, int x_offset)
 {
 	int x, y, top, bottom;
 
+	term->has_last_cell = false;
+
 	x = term->cursor.x + x_offset;
 	y = term->cursor.y + y_offset;
 
@@ -155,35 +884,51 @@ void set_cursor(struct terminal *term, int y, int x)
 
 	term->cursor.x = x;
 	term->cursor.y = y;
+	term->has_last_cell = false;
 }
 
 void addch(struct terminal *term, uint32_t code)
 {
 	int width;
-	const struct glyph_t *glyphp;
+	uint32_t glyph;
+	struct point_t cell;
 
 	if (DEBUG)
 		LOGE("addch: U+%.4X\n", code);
 
-	width = my_wcwidth(code);
+	/* DRCS glyph is looked up by same index as UCS2 glyph */
+	if ((glyph = drcs_glyph(code)) != 0) {
+		code  = glyph;
+		width = HALF;
+	}
+	else
+		width = my_wcwidth(code);
 
-	if (width <= 0) /* zero width */
+	if (width <= 0) { /* zero width: combining character (other code points are ignored) */
+		if (width == 0 && !term->scrolling_off)
+			combine_char(term, code);
 		return;
-	else if (code >= UCS2_CHARS /* yaft support only UCS2 */
-		|| term->glyph_map[code] == NULL /* missing glyph */
-		|| term->glyph_map[code]->width != width) /* width unmatch */
-		glyphp = (width == 1) ? term->glyph_map[SUBSTITUTE_HALF]: term->glyph_map[SUBSTITUTE_WIDE];
-	else
-		glyphp = term->glyph_map[code];
+	}
+	else if (glyph_width(&term->font, code) != width) /* missing glyph (or not UCS2) or width unmatch */
+		code = (width == 1) ? SUBSTITUTE_HALF: SUBSTITUTE_WIDE;
 
 	if ((term->wrap_occured && term->cursor.x == term->cols - 1) /* folding */
-		|| (glyphp->width == WIDE && term->cursor.x == term->cols - 1)) {
+		|| (width == WIDE && term->cursor.x == term->cols - 1)) {
 		set_cursor(term, term->cursor.y, 0);
 		move_cursor(term, 1, 0);
 	}
 	term->wrap_occured = false;
 
-	move_cursor(term, 0, set_cell(term, term->cursor.y, term->cursor.x, glyphp));
+	if (term->scrolling_off) { /* same movement as set_cell() */
+		move_cursor(term, 0, (width == WIDE && term->cursor.x + 1 < term->cols) ? WIDE: HALF);
+		return;
+	}
+
+	/* written cell is kept: cursor does not tell it (stays on it at right margin without auto wrap) */
+	cell = term->cursor;
+	move_cursor(term, 0, set_cell(term, cell.y, cell.x, code));
+	term->last_cell     = cell;
+	term->has_last_cell = true;
 }
 
 void reset_esc(struct terminal *term)
@@ -191,28 +936,33 @@ void reset_esc(struct terminal *term)
 	if (DEBUG)
 		LOGE("*esc reset*\n");
 
-	/*
-	if (term->esc.size > MAX_ESC_SIZE) {
-		term->esc.buf  = erealloc(term->esc.buf, MAX_ESC_SIZE);
-		term->esc.size = MAX_ESC_SIZE;
-	}
-	*/
-
 	term->esc.bp = term->esc.buf;
 	term->esc.state = STATE_RESET;
 }
 
-bool push_esc(struct terminal *term, uint8_t ch)
+/* OSC and other DCS: payload is passed to handler of cmd (see osc.h) byte by byte */
+void start_string(struct terminal *term, int cmd)
 {
-	long offset;
+	term->osc.cmd   = cmd;
+	term->osc.arg   = term->osc.len = 0;
+	term->osc.bits  = term->osc.nbits = 0;
+	term->osc.index = -1;
+	term->osc.esc   = false;
+
+	term->esc.bp    = term->esc.buf; /* esc.buf holds current argument */
+	term->esc.state = STATE_STR;
+}
 
-	if ((term->esc.bp - term->esc.buf + 1) == term->esc.size) { /* buffer limit */
+bool push_esc(struct terminal *term, uint8_t ch)
+{
+	if ((term->esc.bp - term->esc.buf + 1) == term->esc.size) { /* buffer limit: never grows */
 		if (DEBUG)
-			LOGE("escape sequence length >= %d, term.esc.buf reallocated\n", term->esc.size);
-		offset = term->esc.bp - term->esc.buf;
-		term->esc.buf  = erealloc(term->esc.buf, term->esc.size * 2);
-		term->esc.size *= 2;
-		term->esc.bp   = term->esc.buf + offset;
+			LOGE("escape sequence length >= %d, discarded\n", term->esc.size);
+		if (term->esc.state == STATE_OSC || term->esc.state == STATE_DCS)
+			start_string(term, OSC_IGNORE); /* wait for ST */
+		else
+			reset_esc(term);
+		return false;
 	}
 
 	/* ref: http://www.vt100.net/docs/vt102-ug/appendixd.html */
@@ -261,6 +1011,16 @@ bool push_esc(struct terminal *term, uint8_t ch)
 	return false;
 }
 
+/* DCS header without intermediate char: "P" Ps;Ps;... final */
+bool dcs_header(struct terminal *term, uint8_t final)
+{
+	long len = term->esc.bp - term->esc.buf;
+
+	*term->esc.bp = '\0';
+	return len >= 2 && term->esc.buf[0] == 'P' && term->esc.buf[len - 1] == final
+		&& (long) strspn(term->esc.buf + 1, "0123456789;") == len - 2;
+}
+
 void reset_charset(struct terminal *term)
 {
 	term->charset.code = term->charset.count = term->charset.following_byte = 0;
@@ -269,7 +1029,7 @@ void reset_charset(struct terminal *term)
 
 void reset(struct terminal *term)
 {
-	int i, j;
+	int i;
 
 	term->mode = MODE_RESET;
 	term->mode |= (MODE_CURSOR | MODE_AMRIGHT);
@@ -279,6 +1039,7 @@ void reset(struct terminal *term)
 	term->scroll.bottom = term->lines - 1;
 
 	term->cursor.x = term->cursor.y = 0;
+	term->has_last_cell = false;
 
 	term->state.mode = term->mode;
 	term->state.cursor = term->cursor;
@@ -289,69 +1050,255 @@ void reset(struct terminal *term)
 
 	term->attribute = ATTR_RESET;
 
+	for (i = 0; i < COLORS; i++)
+		set_palette(term, i, color_list[i]);
+
 	for (i = 0; i < term->lines; i++) {
-		for (j = 0; j < term->cols; j++) {
-			erase_cell(term, i, j);
-			if ((j % TABSTOP) == 0)
-				term->tabstop[j] = true;
-			else
-				term->tabstop[j] = false;
-		}
-		term->line_dirty[i] = true;
+		fill_cells(term, i, 0, term->cols - 1);
+		damage_line(term, i);
 	}
 
+	reset_tabstop(term, 0);
+
 	reset_esc(term);
 	reset_charset(term);
 }
 
+/* synchronized output: true while app is updating screen (expired update is ended here) */
+bool is_synchronized(struct terminal *term)
+{
+	long msec;
+	struct timespec now;
+
+	if (!(term->mode & MODE_SYNC))
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	msec = (now.tv_sec - term->sync_start.tv_sec) * 1000
+		+ (now.tv_nsec - term->sync_start.tv_nsec) / 1000000;
+
+	if (msec < SYNC_TIMEOUT)
+		return true;
+
+	if (DEBUG)
+		LOGE("synchronized output timed out\n");
+	term->mode &= ~MODE_SYNC;
+	return false;
+}
+
 void redraw(struct terminal *term)
 {
 	int i;
 
 	for (i = 0; i < term->lines; i++)
-		term->line_dirty[i] = true;
+		damage_line(term, i);
 }
 
-void term_init(struct terminal *term, int width, int height)
+void term_init(struct terminal *term, int width, int height, int scale)
 {
-	uint32_t code, gi;
+	int i;
+	struct cell_t blank;
+
+	/* cell size is taken from font */
+	font_init(&term->font, font_path, scale);
 
 	term->width  = width;
 	term->height = height;
 
-	term->cols  = term->width / CELL_WIDTH;
-	term->lines = term->height / CELL_HEIGHT;
+	term->cols  = term->width / term->font.width;
+	term->lines = term->height / term->font.height;
 
 	if (DEBUG)
 		LOGE("width:%d height:%d cols:%d lines:%d\n",
 			width, height, term->cols, term->lines);
 
-	term->line_dirty = (bool *) ecalloc(term->lines, sizeof(bool));
-	term->tabstop    = (bool *) ecalloc(term->cols, sizeof(bool));
-	term->cells      = (struct cell_t *) ecalloc(term->cols * term->lines, sizeof(struct cell_t));
+	term->damage     = (struct damage_t *) ecalloc(term->lines, sizeof(struct damage_t));
+	term->dirty      = (uint64_t *) ecalloc(my_ceil(term->lines, BITS_PER_WORD), sizeof(uint64_t));
+	term->tabstop    = (uint64_t *) ecalloc(my_ceil(term->cols, BITS_PER_WORD), sizeof(uint64_t));
+	term->line_hash  = (uint64_t *) ecalloc(term->lines, sizeof(uint64_t));
+	grid_alloc(&term->cells, term->cols * term->lines);
+
+	grid_alloc(&term->pending.cells, term->cols * term->lines);
+	term->pending.line_hash = (uint64_t *) ecalloc(term->lines, sizeof(uint64_t));
+	term->pending.offset    = 0;
+
+	memset(&term->sgr_cache, 0, sizeof(struct sgr_cache_t));
+	memset(&term->blank_hash, 0, sizeof(struct blank_hash_t)); /* sum is allocated at first use */
+
+	/* style 0 is default colors (fallback of full table) */
+	term->color_pair.fg = DEFAULT_FG;
+	term->color_pair.bg = DEFAULT_BG;
+	term->style.entry  = (struct style_t *) ecalloc(STYLES, sizeof(struct style_t));
+	term->style.bucket = (uint32_t *) ecalloc(STYLES * 2, sizeof(uint32_t));
+	term->style.size   = STYLES;
+	term->style.count  = term->style.next = 0;
+	term->style.generation = 0;
+	term->style.pen    = term->style.blank = style_index(term, term->color_pair, ATTR_RESET);
+
+	term->truecolor.rgb    = (uint32_t *) ecalloc(TRUECOLORS, sizeof(uint32_t));
+	term->truecolor.bucket = (uint16_t *) ecalloc(TRUECOLOR_BUCKETS, sizeof(uint16_t));
+	term->truecolor.count  = term->truecolor.next = 0;
+	term->truecolor.generation = 0;
+
+	term->image.slot  = (struct image_t **) ecalloc(IMAGE_SLOTS, sizeof(struct image_t *));
+	term->image.count = term->image.next = 0;
+	term->image.bytes = 0;
+	term->image.clock = 0;
+	term->image.generation = 0;
+	term->sixel.pixels = NULL;
+
+	term->combining.code = (uint32_t *) ecalloc(COMBINING_ARENA, sizeof(uint32_t));
+	term->combining.size = COMBINING_ARENA;
+	term->combining.used = 0;
+	term->combining.generation = 0;
 
 	term->esc.buf  = (char *) ecalloc(1, MAX_ESC_SIZE);
 	term->esc.size = MAX_ESC_SIZE;
 
-	/* initialize glyph map */
-	for (code = 0; code < UCS2_CHARS; code++)
-		term->glyph_map[code] = NULL;
+	term->scrolling_off = false;
 
-	for (gi = 0; gi < sizeof(glyphs) / sizeof(struct glyph_t); gi++)
-		term->glyph_map[glyphs[gi].code] = &glyphs[gi];
+	term->title[0]      = '\0';
+	term->clipboard     = NULL;
+	term->clipboard_len = 0;
 
-	if (term->glyph_map[DEFAULT_CHAR] == NULL
-		|| term->glyph_map[SUBSTITUTE_HALF] == NULL
-		|| term->glyph_map[SUBSTITUTE_WIDE] == NULL)
-		fatal("cannot find DEFAULT_CHAR or SUBSTITUTE_HALF or SUBSTITUTE_HALF\n");
+	/* fb converts palette at first refresh (fb starts from generation 0) */
+	memcpy(term->palette, color_list, sizeof(term->palette));
+	memset(term->palette_version, 0, sizeof(term->palette_version));
+	term->palette_generation = 1;
+
+	/* cells must be valid before first hash update */
+	blank = blank_cell(term);
+	grid_fill(&term->cells, 0, term->cols * term->lines, &blank);
+	for (i = 0; i < term->lines; i++)
+		rehash_line(term, i);
+	recount_styles(term);
 
 	reset(term);
 }
 
+void term_resize(struct terminal *term, int width, int height)
+{
+	int i, n, old_cols, old_lines, shift;
+	struct cell_t blank;
+	struct grid_t old_cells, line;
+	struct winsize ws;
+
+	flush_scroll(term);
+
+	old_cols  = term->cols;
+	old_lines = term->lines;
+	old_cells = term->cells;
+
+	term->width  = width;
+	term->height = height;
+
+	term->cols  = term->width / term->font.width;
+	term->lines = term->height / term->font.height;
+
+	if (term->cols == old_cols && term->lines == old_lines)
+		return;
+
+	if (DEBUG)
+		LOGE("resize cols:%d lines:%d -> cols:%d lines:%d\n",
+			old_cols, old_lines, term->cols, term->lines);
+
+	/* keep cursor line visible: drop top lines if necessary */
+	shift = (term->cursor.y >= term->lines) ? term->cursor.y - (term->lines - 1): 0;
+
+	term->damage     = (struct damage_t *) erealloc(term->damage, term->lines * sizeof(struct damage_t));
+	term->dirty      = (uint64_t *) erealloc(term->dirty, my_ceil(term->lines, BITS_PER_WORD) * sizeof(uint64_t));
+	term->tabstop    = (uint64_t *) erealloc(term->tabstop, my_ceil(term->cols, BITS_PER_WORD) * sizeof(uint64_t));
+	bit_fill(term->dirty, 0, my_ceil(term->lines, BITS_PER_WORD) * BITS_PER_WORD - 1, false); /* see redraw() below */
+	term->line_hash  = (uint64_t *) erealloc(term->line_hash, term->lines * sizeof(uint64_t));
+	grid_alloc(&term->cells, term->cols * term->lines);
+
+	grid_free(&term->pending.cells);
+	grid_alloc(&term->pending.cells, term->cols * term->lines);
+	term->pending.line_hash = (uint64_t *) erealloc(term->pending.line_hash, term->lines * sizeof(uint64_t));
+
+	blank = blank_cell(term);
+	for (i = 0; i < term->lines; i++) {
+		line = grid_at(&term->cells, i * term->cols);
+		n    = 0;
+		if ((i + shift) < old_lines) {
+			n = (old_cols < term->cols) ? old_cols: term->cols;
+			grid_move(&line, 0, &old_cells, (i + shift) * old_cols, n);
+		}
+		grid_fill(&line, n, term->cols - n, &blank);
+		/* right half of wide character was cut off */
+		if (line.width[term->cols - 1] == WIDE)
+			grid_put(&line, term->cols - 1, &blank);
+		rehash_line(term, i);
+	}
+	grid_free(&old_cells);
+	recount_styles(term);
+
+	/* tabstops of old columns are kept */
+	reset_tabstop(term, (old_cols < term->cols) ? old_cols: term->cols);
+
+	term->scroll.top    = 0;
+	term->scroll.bottom = term->lines - 1;
+	term->wrap_occured  = false;
+
+	term->cursor.y -= shift;
+	set_cursor(term, term->cursor.y, term->cursor.x);
+	term->state.cursor.x = (term->state.cursor.x >= term->cols) ? term->cols - 1: term->state.cursor.x;
+	term->state.cursor.y = (term->state.cursor.y >= term->lines) ? term->lines - 1: term->state.cursor.y;
+
+	redraw(term);
+
+	/* notify new window size to shell (pty sends SIGWINCH) */
+	ws.ws_row = term->lines;
+	ws.ws_col = term->cols;
+	ws.ws_xpixel = ws.ws_ypixel = 0;
+	ioctl(term->fd, TIOCSWINSZ, &ws);
+}
+
+/* change glyph scale in place: grid and pty winsize follow new cell size */
+bool term_scale(struct terminal *term, int scale)
+{
+	if (scale < 1 || scale > MAX_FONT_SCALE || scale == term->font.scale
+		|| term->width < term->font.src_width * scale
+		|| term->height < term->font.src_height * scale)
+		return false;
+
+	if (DEBUG)
+		LOGE("scale:%d -> scale:%d\n", term->font.scale, scale);
+
+	set_font_scale(&term->font, scale);
+	term_resize(term, term->width, term->height);
+	redraw(term); /* cell size changed even if cols and lines did not */
+
+	return true;
+}
+
 void term_die(struct terminal *term)
 {
-	free(term->line_dirty);
+	int i;
+
+	free(term->damage);
+	free(term->dirty);
 	free(term->tabstop);
-	free(term->cells);
+	grid_free(&term->cells);
+	free(term->line_hash);
+	grid_free(&term->pending.cells);
+	free(term->pending.line_hash);
+	free(term->blank_hash.sum);
+	free(term->style.entry);
+	free(term->style.bucket);
+	free(term->truecolor.rgb);
+	free(term->truecolor.bucket);
+	for (i = 0; i < IMAGE_SLOTS; i++) {
+		if (term->image.slot[i] != NULL) {
+			free(term->image.slot[i]->pixels);
+			free(term->image.slot[i]);
+		}
+	}
+	free(term->image.slot);
+	free(term->sixel.pixels);
+	free(term->combining.code);
 	free(term->esc.buf);
+	free(term->clipboard);
+
+	font_die(&term->font);
 }
@@ -316,11 +316,86 @@ uint32_t bit_reverse(uint32_t val, int bits)
 	return ret <<= shift;
 }
 
+uint64_t mix64(uint64_t val)
+{
+	/* splitmix64 finalizer */
+	val ^= val >> 30;
+	val *= 0xBF58476D1CE4E5B9ULL;
+	val ^= val >> 27;
+	val *= 0x94D049BB133111EBULL;
+	val ^= val >> 31;
+
+	return val;
+}
+
+/* FNV-1a: hash = fnv1a(fnv_basis, byte), hash = fnv1a(hash, next byte)... */
+const uint64_t fnv_basis = 0xCBF29CE484222325ULL;
+
+static inline uint64_t fnv1a(uint64_t hash, uint8_t byte)
+{
+	return (hash ^ byte) * 0x100000001B3ULL;
+}
+
 int my_ceil(int val, int div)
 {
 	return (val + div - 1) / div;
 }
 
+/* bitset: packed flags in uint64_t words (bits above used size are kept 0) */
+static inline bool bit_test(const uint64_t *set, int i)
+{
+	return (set[i / BITS_PER_WORD] >> (i % BITS_PER_WORD)) & 1;
+}
+
+static inline void bit_set(uint64_t *set, int i)
+{
+	set[i / BITS_PER_WORD] |= 1ULL << (i % BITS_PER_WORD);
+}
+
+static inline void bit_clear(uint64_t *set, int i)
+{
+	set[i / BITS_PER_WORD] &= ~(1ULL << (i % BITS_PER_WORD));
+}
+
+/* set or clear bits [first, last]: one mask per word */
+void bit_fill(uint64_t *set, int first, int last, bool value)
+{
+	int i, end;
+	uint64_t mask;
+
+	for (i = first; i <= last; i = end + 1) {
+		end = (i / BITS_PER_WORD + 1) * BITS_PER_WORD - 1;
+		if (end > last)
+			end = last;
+		mask = (~0ULL >> (BITS_PER_WORD - 1 - (end - i))) << (i % BITS_PER_WORD);
+		if (value)
+			set[i / BITS_PER_WORD] |= mask;
+		else
+			set[i / BITS_PER_WORD] &= ~mask;
+	}
+}
+
+/* first set bit at or after from: return size if not found */
+int bit_next(const uint64_t *set, int from, int size)
+{
+	int i, words = my_ceil(size, BITS_PER_WORD);
+	uint64_t word;
+
+	if (from >= size)
+		return size;
+
+	i    = from / BITS_PER_WORD;
+	word = set[i] & (~0ULL << (from % BITS_PER_WORD));
+	while (word == 0) {
+		if (++i >= words)
+			return size;
+		word = set[i];
+	}
+	from = i * BITS_PER_WORD + __builtin_ctzll(word);
+
+	return (from < size) ? from: size;
+}
+
 int dec2num(char *str)
 {
 	if (str == NULL)
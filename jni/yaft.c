@@ -5,11 +5,16 @@
 #include "color.h"
 #include "keycode.h"
 #include "util.h"
+#include "font.h"
 #include "wcwidth.h"
-#include "android.h"
 #include "terminal.h"
+#include "sixel.h"
+#include "drcs.h"
+#include "osc.h"
 #include "function.h"
 #include "parse.h"
+#include "cache.h"
+#include "android.h"
 
 volatile sig_atomic_t loop_flag = true;
 
@@ -78,7 +83,8 @@ static int32_t app_handle_input(struct android_app *app, AInputEvent* event) {
 	int action, keycode, keysym;
 	const char *keyseq;
 
-	if (AInputEvent_getType(event) != AINPUT_EVENT_TYPE_KEY)
+	if (state->initialized == false
+		|| AInputEvent_getType(event) != AINPUT_EVENT_TYPE_KEY)
 		return 0;
 
 	action  = AKeyEvent_getAction(event); 
@@ -114,6 +120,23 @@ static int32_t app_handle_input(struct android_app *app, AInputEvent* event) {
 		|| keycode == AKEYCODE_MENU)
 		return 0;
 
+	/* Ctrl+Alt+'=' / Ctrl+Alt+'-': change glyph scale */
+	if ((state->keystate & CTRL_MASK) && (state->keystate & ALT_MASK)
+		&& (keycode == AKEYCODE_EQUALS || keycode == AKEYCODE_MINUS)) {
+		if (action == AKEY_EVENT_ACTION_DOWN
+			&& term_scale(state->term, state->term->font.scale + ((keycode == AKEYCODE_EQUALS) ? 1: -1))
+			&& state->attached)
+			refresh(state->fb, state->term);
+		return 1;
+	}
+
+	/* Ctrl+Alt+'v': paste clipboard set by OSC 52 */
+	if ((state->keystate & CTRL_MASK) && (state->keystate & ALT_MASK) && keycode == AKEYCODE_V) {
+		if (action == AKEY_EVENT_ACTION_DOWN && state->term->clipboard_len > 0)
+			ewrite(state->term->fd, state->term->clipboard, state->term->clipboard_len);
+		return 1;
+	}
+
 	if (action == AKEY_EVENT_ACTION_DOWN) {
 		if (keycode == AKEYCODE_SHIFT_RIGHT || keycode == AKEYCODE_SHIFT_LEFT)
 			state->keystate |= SHIFT_MASK;
@@ -147,26 +170,66 @@ static int32_t app_handle_input(struct android_app *app, AInputEvent* event) {
 	return 1;
 }
 
-void app_init(struct app_state *state)
+int font_scale(struct android_app *app)
+{
+	int32_t density;
+
+	if (FONT_SCALE > 0)
+		return FONT_SCALE;
+
+	/* 6x13 glyph is readable at mdpi (160dpi) */
+	density = AConfiguration_getDensity(app->config);
+	if (density == ACONFIGURATION_DENSITY_DEFAULT || density >= ACONFIGURATION_DENSITY_ANY
+		|| density < ACONFIGURATION_DENSITY_MEDIUM)
+		return 1;
+
+	return (density / ACONFIGURATION_DENSITY_MEDIUM > MAX_FONT_SCALE) ?
+		MAX_FONT_SCALE: density / ACONFIGURATION_DENSITY_MEDIUM;
+}
+
+void app_attach(struct app_state *state)
 {
-	sig_set();
+	/* bind the new window: terminal and shell survive from the previous window */
 	fb_init(state->fb);
-	term_init(state->term, state->fb->width, state->fb->height);
-	fork_and_exec(&state->term->fd, state->term->lines, state->term->cols);
-	state->focused = true;
-	state->initialized = true;
+
+	if (state->initialized == false) {
+		sig_set();
+		term_init(state->term, state->fb->width, state->fb->height, font_scale(state->fb->app));
+		fork_and_exec(&state->term->fd, state->term->lines, state->term->cols);
+		state->initialized = true;
+	}
+	else if (state->term->width != state->fb->width
+		|| state->term->height != state->fb->height)
+		term_resize(state->term, state->fb->width, state->fb->height);
+
+	state->attached = true;
+	state->focused  = true;
 	//state->softkeyboard_visible = false;
+
+	/* new framebuffer has no content: draw whole screen from cells */
+	redraw(state->term);
+	refresh(state->fb, state->term);
+}
+
+void app_detach(struct app_state *state)
+{
+	if (state->attached == false)
+		return;
+
+	fb_die(state->fb);
+	state->attached = false;
+	state->focused  = false;
 }
 
 void app_die(struct app_state *state)
 {
+	app_detach(state);
+
 	if (state->initialized == false)
 		return;
 
 	term_die(state->term);
-	fb_die(state->fb);
 	sig_reset();
-	state->focused = false;
 	state->initialized = false;
 }
 
@@ -197,10 +260,10 @@ static void app_handle_cmd(struct android_app *app, int32_t cmd) {
 	switch (cmd) {
 	case APP_CMD_INIT_WINDOW:
 		if (app->window != NULL)
-			app_init(state);
+			app_attach(state);
 		break;
 	case APP_CMD_TERM_WINDOW:
-		app_die(state);
+		app_detach(state);
 		break;
 	case APP_CMD_GAINED_FOCUS:
 		state->focused = true;
@@ -215,7 +278,7 @@ static void app_handle_cmd(struct android_app *app, int32_t cmd) {
 
 void android_main(struct android_app *app)
 {
-	uint8_t buf[BUFSIZE];
+	static uint8_t buf[READ_BUFSIZE];
 	char log[BUFSIZE + 1];
 	ssize_t size;
 	fd_set fds;
@@ -235,6 +298,7 @@ void android_main(struct android_app *app)
 	state.keystate = 0;
 	state.focused  = false;
 	state.initialized = false;
+	state.attached = false;
 
 	/* android */
 	app_dummy();
@@ -243,7 +307,7 @@ void android_main(struct android_app *app)
 	app->onInputEvent = app_handle_input;
 
 	while (loop_flag) {
-		/* handle shell output */
+		/* handle shell output: keep parsing even if there is no window */
 		if (state.initialized) {
 			FD_ZERO(&fds);
 			FD_SET(term.fd, &fds);
@@ -252,7 +316,7 @@ void android_main(struct android_app *app)
 			eselect(term.fd + 1, &fds, NULL, NULL, &tv);
 
 			if (FD_ISSET(term.fd, &fds)) {
-				size = read(term.fd, buf, BUFSIZE);
+				size = read(term.fd, buf, READ_BUFSIZE);
 				if (size > 0) {
 					if (DEBUG) {
 						snprintf(log, BUFSIZE + 1, "%s", buf);
@@ -260,12 +324,16 @@ void android_main(struct android_app *app)
 					}
 					parse(&term, buf, size);
 
-					if (LAZY_DRAW && size == BUFSIZE)
+					if (LAZY_DRAW && size == READ_BUFSIZE)
 						continue;
-					if (state.focused)
+					if (state.attached && state.focused)
 						refresh(&fb, &term);
 				}
 			}
+			else if ((term.mode & MODE_SYNC) && state.attached && state.focused) {
+				/* app may never end synchronized output: drawn after SYNC_TIMEOUT */
+				refresh(&fb, &term);
+			}
 		}
 
 		/* handle keyboard input */
@@ -14,7 +14,9 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <android/log.h>
@@ -28,21 +30,34 @@ enum char_code {
 	/* 7 bit */
 	BEL = 0x07, BS  = 0x08, HT  = 0x09,
 	LF  = 0x0A, VT  = 0x0B, FF  = 0x0C,
-	CR  = 0x0D, ESC = 0x1B, DEL = 0x7F,
+	CR  = 0x0D, CAN = 0x18, SUB = 0x1A,
+	ESC = 0x1B, DEL = 0x7F,
 	/* others */
 	SPACE     = 0x20,
 	BACKSLASH = 0x5C,
 };
 
 enum misc {
-	BUFSIZE           = 1024,    /* read, esc, various buffer size */
+	BUFSIZE           = 1024,    /* esc, various buffer size */
+	READ_BUFSIZE      = 64 * 1024, /* read buffer of pty output (plain text burst is looked ahead in it) */
 	BITS_PER_BYTE     = 8,
+	BITS_PER_WORD     = 64,      /* bitset word (uint64_t) */
 	BYTES_PER_PIXEL   = 3,
 	BITS_PER_SIXEL    = 6,       /* number of bits of a sixel */
-	MAX_ESC_SIZE      = 256,     /* limit size of terminal escape sequence */
+	MAX_ESC_SIZE      = 256,     /* size of escape sequence buffer (OSC/DCS payload is not stored) */
 	SELECT_TIMEOUT    = 15000,   /* used by select() */
 	MAX_ARGS          = 16,      /* max parameters of csi/osc sequence */
+	MAX_FONT_SCALE    = 8,       /* limit of integer glyph scale */
 	COLORS            = 256,     /* num of color */
+	TRUECOLORS        = 4096,    /* num of interned 24bit color (color index: COLORS + n) */
+	STYLES            = 256,     /* initial entries of style table (doubled when full) */
+	MAX_STYLES        = 0x10000, /* limit of style table (style ID is 16bit) */
+	COMBINING_ARENA   = 1024,    /* initial code points of combining arena (doubled when full) */
+	MAX_COMBINING_ARENA = 0x100000, /* limit of combining arena (offset is 20bit, see terminal.h) */
+	MAX_COMBINING     = 8,       /* combining characters kept per cell (more are dropped) */
+	SIXEL_COLORS      = 255,     /* num of sixel color register (pixel value 255: not painted) */
+	SIXEL_MAX_SIZE    = 4096,    /* limit of sixel image width and height (pixel) */
+	IMAGE_SLOTS       = 1024,    /* num of sixel image referred by cells (see sixel.h) */
 	UCS2_CHARS        = 0x10000, /* number of UCS2 glyph */
 	CTRL_CHARS        = 0x20,    /* number of ctrl_func */
 	ESC_CHARS         = 0x80,    /* number of esc_func */
@@ -51,6 +66,12 @@ enum misc {
 	DEFAULT_CHAR      = SPACE,   /* used for erase char, cell_size */
 	BRIGHT_INC        = 8,       /* value used for brightening color */
 	OSC_GWREPT        = 8900,    /* OSC Ps: mode number of yaft GWREPT */
+	OSC_FUNCS         = 112,     /* number of osc_func (OSC Ps: 0 - 111) */
+	OSC_IGNORE        = -1,      /* OSC Ps: payload is discarded (see osc.h) */
+	OSC_TITLE_SIZE    = 256,     /* limit of window title (OSC 0/2) */
+	OSC_CLIPBOARD_SIZE = 64 * 1024, /* limit of decoded clipboard (OSC 52) */
+	SGR_CACHE_SIZE    = 64,      /* entries of SGR cache (power of 2) */
+	SGR_KEY_SIZE      = 24,      /* longest SGR parameter string that is cached */
 };
 
 enum char_attr {
@@ -83,6 +104,8 @@ enum term_mode {
 	MODE_ORIGIN  = 0x01, /* origin mode: DECOM */
 	MODE_CURSOR  = 0x02, /* cursor visible: DECTCEM */
 	MODE_AMRIGHT = 0x04, /* auto wrap: DECAWM */
+	MODE_SYNC    = 0x08, /* synchronized output: DECSET 2026 */
+	MODE_REVERSE = 0x10, /* reverse screen: DECSCNM */
 };
 
 enum esc_state {
@@ -91,6 +114,22 @@ enum esc_state {
 	STATE_CSI    = 0x02, /* ESC [ */
 	STATE_OSC    = 0x04, /* ESC ] */
 	STATE_DCS    = 0x08, /* ESC P */
+	STATE_SIXEL  = 0x10, /* ESC P P1;P2;P3 q: sixel data is decoded without esc.buf */
+	STATE_DRCS   = 0x20, /* ESC P Pfn;Pcn;Pe;...{: soft font (DECDLD) is decoded without esc.buf */
+	STATE_STR    = 0x40, /* ESC ] Ps; or other DCS: payload is streamed to handler without esc.buf */
+};
+
+enum sixel_state {
+	SIXEL_DATA = 0,
+	SIXEL_REPEAT, /* '!' Pn */
+	SIXEL_RASTER, /* '"' Pan;Pad;Ph;Pv */
+	SIXEL_COLOR,  /* '#' Pc;Pu;Px;Py;Pz */
+};
+
+enum cursor_shape {
+	CURSOR_BLOCK = 0,
+	CURSOR_UNDERLINE,
+	CURSOR_BAR,
 };
 
 enum glyph_width_t {
@@ -101,13 +140,35 @@ enum glyph_width_t {
 
 struct margin { uint16_t top, bottom; };
 struct point_t { uint16_t x, y; };
-struct color_pair_t { uint8_t fg, bg; };
+struct color_pair_t { uint16_t fg, bg; }; /* palette index or interned 24bit color */
+struct damage_t { uint16_t first, last; }; /* dirty column range: valid only if line is in dirty bitset */
 
-struct cell_t {
-	const struct glyph_t *glyphp;   /* pointer to glyph */
-	struct color_pair_t color_pair; /* color (fg, bg) */
-	enum char_attr attribute;       /* bold, underscore, etc... */
-	enum glyph_width_t width;       /* wide char flag: WIDE, NEXT_TO_WIDE, HALF */
+struct cell_t {                     /* one cell (written by write_cell(), read by grid_cell()) */
+	uint32_t code;                  /* code of glyph (see font.h) or image tile (see sixel.h) */
+	uint16_t style;                 /* colors and attribute: entry of style table (see style_index()) */
+	uint8_t width;                  /* wide char flag (enum glyph_width_t): WIDE, NEXT_TO_WIDE, HALF */
+};
+
+struct grid_t {                     /* cells stored as one plane per field: plane[x + y * cols] */
+	uint32_t *code;
+	uint16_t *style;
+	uint8_t *width;
+};
+
+struct font_t {
+	int width, height;              /* cell size (pixel): glyph size * scale */
+	int src_width, src_height;      /* glyph size of font */
+	int scale;                      /* integer scale factor */
+	unsigned char *map;             /* mmap'ed PSF2 file (NULL: compiled-in glyphs) */
+	size_t size;                    /* size of map */
+	const unsigned char *bitmap;    /* PSF2: first glyph */
+	int bytes_per_glyph;            /* PSF2: size of each glyph */
+	int32_t *index;                 /* code -> glyph number (see font.h) */
+	uint8_t *atlas;                 /* scaled glyphs, 1 byte per pixel: (width * glyph width) x height */
+	size_t atlas_size, atlas_used;  /* bytes */
+	uint32_t *atlas_index;          /* code -> offset in atlas + 1 (0: not decoded yet) */
+	uint8_t *drcs[DRCS_CHARSETS];   /* soft font: GLYPH_PER_CHARSET glyphs of each charset (NULL: not loaded) */
+	unsigned generation;            /* incremented when defined glyph is changed */
 };
 
 struct esc_t {
@@ -119,11 +180,120 @@ struct esc_t {
 
 struct charset_t {
 	uint32_t code; /* UCS4 code point:
-					but only print UCS2 and DRCSMMv1 */
+					but only print UCS2 and DRCSMMv1 (see drcs_glyph()) */
 	int following_byte, count;
 	bool is_valid;
 };
 
+struct truecolor_t {
+	uint32_t *rgb;      /* interned 24bit colors (with TRUECOLOR_USED flag) */
+	uint16_t *bucket;   /* hash table: rgb index + 1 (0: empty) */
+	int count, next;    /* num of used entries, next entry to search free one */
+	unsigned generation; /* incremented when freed entries may be reused */
+};
+
+struct combining_t {                /* arena of combined cells (see combine_char()) */
+	uint32_t *code;                 /* entry: base code, number of marks, marks */
+	int size, used;                 /* allocated and used code points (entries are appended) */
+	unsigned generation;            /* incremented when entries are moved by compaction */
+};
+
+struct style_t {                    /* interned (color pair, attribute) */
+	struct color_pair_t color_pair; /* color (fg, bg) as set by SGR */
+	struct color_pair_t color;      /* color that cells are drawn with (see style_color()) */
+	uint8_t attribute;              /* bold, underscore, etc... */
+	bool used;
+	int cells;                      /* number of cells that refer style (0: freed at next sweep) */
+};
+
+struct style_table_t {
+	struct style_t *entry;          /* size entries (style 0: default colors, never freed) */
+	uint32_t *bucket;               /* hash table (size * 2): style + 1 (0: empty) */
+	int size, count, next;          /* allocated entries, used entries, next entry to search free one */
+	uint16_t pen, blank;            /* last style of written cell and of erased cell (see pen_style()) */
+	unsigned generation;            /* incremented when freed entries may be reused */
+};
+
+struct blank_hash_t {               /* hash of erased cells (see blank_hash()) */
+	uint16_t style;
+	int cols;
+	unsigned palette_generation, style_generation;
+	uint64_t *sum;                  /* sum[x]: hash of blank cells [0, x - 1] (cols + 1 entries) */
+};
+
+struct image_t {
+	uint8_t *pixels;                /* sixel color register of each pixel: width x height */
+	int width, height;              /* image size (pixel) */
+	int tile_width, tile_height;    /* cell size when image was placed */
+	int tile_cols;                  /* tiles per row */
+	unsigned long used;             /* placed time (for LRU eviction) */
+	bool mark;                      /* referred by cells (for gc) */
+	uint32_t palette[SIXEL_COLORS]; /* rgb of color registers */
+};
+
+struct image_store_t {
+	struct image_t **slot;          /* IMAGE_SLOTS entries (NULL: free slot) */
+	int count, next;                /* num of used slots, next slot to search free one */
+	size_t bytes;                   /* memory used by images */
+	unsigned long clock;            /* incremented when image is placed */
+	unsigned generation;            /* incremented when freed slots may be reused */
+};
+
+struct sixel_t {                    /* streaming sixel decoder */
+	uint8_t *pixels;                /* decoded pixels (SIXEL_COLORS: not painted) */
+	int stride, rows;               /* allocated size (pixel) */
+	int width, height;              /* painted size (pixel) */
+	int x, y;                       /* current position (y: top of sixel band) */
+	int color;                      /* current color register */
+	enum sixel_state state;
+	int param[MAX_ARGS], nparam;    /* parameters of '!', '"', '#' */
+	bool esc;                       /* ESC received: ST or interrupted */
+	uint32_t palette[SIXEL_COLORS]; /* rgb of color registers */
+};
+
+struct drcs_t {                     /* streaming DECDLD decoder */
+	int charset;                    /* charset of Dscs (see drcs.h) */
+	int glyph;                      /* glyph number in charset */
+	int erase;                      /* Pe: 0 this charset, 1 loaded glyphs only, 2 all charsets */
+	int x, y;                       /* current position in glyph (y: top of sixel band) */
+	bool esc;                       /* ESC received: ST or interrupted */
+};
+
+struct osc_t {                      /* streaming OSC handler */
+	int cmd;                        /* OSC Ps (OSC_IGNORE: payload is discarded) */
+	int arg;                        /* number of ';' in payload (esc.buf holds current argument) */
+	int len;                        /* bytes stored by handler */
+	uint32_t bits;                  /* base64: pending bits */
+	int nbits;
+	int index;                      /* OSC 4: color index of current spec */
+	bool esc;                       /* ESC received: ST or interrupted */
+};
+
+struct sgr_t {                      /* effect of SGR parameters (see set_attr_num()) */
+	uint8_t keep, set;              /* attribute = (attribute & keep) | set */
+	bool set_fg, set_bg;            /* color is replaced or not */
+	struct color_pair_t color_pair;
+};
+
+struct sgr_entry_t {
+	bool used;
+	uint8_t len;
+	char key[SGR_KEY_SIZE];         /* SGR parameter string (without ESC '[' and 'm') */
+	struct sgr_t sgr;
+};
+
+struct sgr_cache_t {                /* direct mapped: hash of parameter string -> effect */
+	struct sgr_entry_t entry[SGR_CACHE_SIZE];
+	unsigned long hits, misses;     /* statistics */
+};
+
+struct scroll_t {                   /* deferred scroll of one region (see scroll()) */
+	int from, to;                   /* scroll region */
+	int offset;                     /* pending offset (0: nothing is pending, > 0: up, < 0: down) */
+	struct grid_t cells;            /* lines scrolled in: blank or written after scroll */
+	uint64_t *line_hash;            /* hash of lines scrolled in */
+};
+
 struct state_t {   /* for save, restore state */
 	struct point_t cursor;
 	enum term_mode mode;
@@ -134,20 +304,41 @@ struct terminal {
 	int fd;                             /* master fd */
 	int width, height;                  /* terminal size (pixel) */
 	int cols, lines;                    /* terminal size (cell) */
-	struct cell_t *cells;               /* pointer to each cell: cells[cols + lines * num_of_cols] */
+	struct grid_t cells;                /* planes of cells (see grid_at()) */
 	struct margin scroll;               /* scroll margin */
 	struct point_t cursor;              /* cursor pos (x, y) */
-	bool *line_dirty;                   /* dirty flag */
-	bool *tabstop;                      /* tabstop flag */
+	struct damage_t *damage;            /* dirty columns of each line */
+	uint64_t *dirty;                    /* damaged lines (bitset) */
+	uint64_t *line_hash;                /* content hash of each line */
+	struct scroll_t pending;            /* scroll not yet applied to cells */
+	uint64_t *tabstop;                  /* tabstop flags (bitset) */
 	enum term_mode mode;                /* for set/reset mode */
+	struct timespec sync_start;         /* begin of synchronized output (MODE_SYNC) */
 	bool wrap_occured;                  /* whether auto wrap occured or not */
+	struct point_t last_cell;           /* cell written by last addch(): combining character is attached to it */
+	bool has_last_cell;                 /* last_cell is valid (cleared by cursor movement and scroll) */
+	bool scrolling_off;                 /* output surely scrolls out: cursor moves but cells are not written (see parse.h) */
 	struct state_t state;               /* for restore */
 	struct color_pair_t color_pair;     /* color (fg, bg) */
+	struct style_table_t style;         /* (color pair, attribute) referred by cells */
+	struct blank_hash_t blank_hash;     /* cached hash of blank cells */
+	struct sgr_cache_t sgr_cache;       /* effect of SGR parameter strings seen before */
+	struct truecolor_t truecolor;       /* 24bit colors referred by cells */
+	struct image_store_t image;         /* sixel images referred by cells */
+	struct combining_t combining;       /* combining characters referred by cells */
+	struct sixel_t sixel;               /* sixel decoder */
+	struct drcs_t drcs;                 /* soft font decoder */
+	struct osc_t osc;                   /* OSC handler */
+	char title[OSC_TITLE_SIZE];         /* window title (OSC 0/2) */
+	uint8_t *clipboard;                 /* OSC 52 (pasted by Ctrl+Alt+'v') */
+	int clipboard_len;
+	uint32_t palette[COLORS];           /* rgb of color index (OSC 4/10/11/104) */
+	unsigned palette_version[COLORS];   /* palette_generation when color index was changed (hashed with cells) */
+	unsigned palette_generation;        /* incremented when palette is changed */
 	enum char_attr attribute;           /* bold, underscore, etc... */
 	struct charset_t charset;           /* store UTF-8 byte stream */
 	struct esc_t esc;                   /* store escape sequence */
-	const struct glyph_t
-		*glyph_map[UCS2_CHARS];
+	struct font_t font;                 /* glyphs and cell size */
 };
 
 struct parm_t { /* for parse_arg() */
@@ -0,0 +1,97 @@
+/* See LICENSE for licence details. */
+/*
+	fillbench: time erase/insert/delete handlers (function.h) built on fill_cells() and move_cells()
+
+	$ make fillbench
+	$ ./fillbench [ops [cols lines]]
+
+	- each handler is called ops times (default 100000) on cols x lines grid (default 40x21)
+	  with random cursor and parameter (EL/ED: mode 0-2, ECH/ICH/DCH: 1 to cols / 2)
+	- before each call, cursor line is written again with colored text and wide chars
+	  (so fills and moves cut wide chars at their edges): only handler is timed
+*/
+#include "tool.h"
+
+enum {
+	OPS   = 100000,
+	COLS  = 40,
+	LINES = 21,
+};
+
+struct handler_t {
+	const char *name;
+	void (*func)(struct terminal *term, struct parm_t *parm);
+	bool mode; /* parameter is mode (0-2) or count */
+};
+
+static const struct handler_t handlers[] = {
+	{ "EL",  erase_line,    true  },
+	{ "ED",  erase_display, true  },
+	{ "ECH", erase_char,    false },
+	{ "ICH", insert_blank,  false },
+	{ "DCH", delete_char,   false },
+};
+
+/* one screen line of text: ASCII and wide chars with some SGR */
+static int gen_line(char *buf, int cols)
+{
+	int x = 0, len = 0;
+
+	len += sprintf(buf + len, "\033[%d;%dm", 30 + rnd(8), 40 + rnd(8));
+	while (x < cols) {
+		if (rnd(4) == 0 && x + 1 < cols) {
+			len += sprintf(buf + len, "\xE6\xBC\xA2");
+			x += WIDE;
+		}
+		else {
+			buf[len++] = '!' + rnd(94);
+			x += HALF;
+		}
+	}
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, h, y;
+	int ops   = (argc > 1) ? atoi(argv[1]): OPS;
+	int cols  = (argc > 3) ? atoi(argv[2]): COLS;
+	int lines = (argc > 3) ? atoi(argv[3]): LINES;
+	int64_t start, total;
+	char *buf, num[16];
+	struct parm_t parm;
+	struct terminal term;
+
+	/* SGR and 3 bytes per wide char (2 columns) */
+	buf = (char *) ecalloc(cols * 2 + BUFSIZE, 1);
+
+	for (h = 0; h < (int) (sizeof(handlers) / sizeof(handlers[0])); h++) {
+		rnd_seed(h + 1);
+		open_term(&term, cols, lines);
+		for (y = 0; y < lines; y++) {
+			set_cursor(&term, y, 0);
+			parse(&term, (uint8_t *) buf, gen_line(buf, cols));
+		}
+
+		total = 0;
+		for (i = 0; i < ops; i++) {
+			y = rnd(lines);
+			set_cursor(&term, y, 0);
+			parse(&term, (uint8_t *) buf, gen_line(buf, cols));
+			set_cursor(&term, y, rnd(cols));
+
+			snprintf(num, sizeof(num), "%d", handlers[h].mode ? (int) rnd(3): 1 + (int) rnd(cols / 2));
+			parm.argc    = 1;
+			parm.argv[0] = num;
+
+			start = now_ns();
+			handlers[h].func(&term, &parm);
+			total += now_ns() - start;
+		}
+		close_term(&term);
+
+		printf("%-4s %8.1f ms %8.1f ns/op\n", handlers[h].name, total / 1e6, (double) total / ops);
+	}
+	free(buf);
+	return EXIT_SUCCESS;
+}
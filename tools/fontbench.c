@@ -0,0 +1,113 @@
+/* See LICENSE for licence details. */
+/*
+	fontbench: compare font cold start: compiled-in glyphs (glyph.h) and mmap'ed PSF2 (load_psf2())
+
+	$ make fontbench
+	$ ./fontbench [font.psf...]
+
+	- without file, two PSF2 fonts (8x16) are written to /tmp:
+	  same codes as compiled-in glyphs (GLYPH_CODES) and whole BMP (unifont like, about 63000 glyphs)
+	- init : font_init() (PSF2: header and unicode table are read, compiled-in: glyph_code[] is indexed)
+	  first: get_glyph() of first screen (printable ASCII and 128 other codes that font has)
+	- best of 20 runs: file stays in page cache after first run (cost of disk read is not included)
+*/
+#include "tool.h"
+
+enum {
+	RUNS        = 20,
+	OTHER_CODES = 128,
+	PSF2_WIDTH  = 8,
+	PSF2_HEIGHT = 16,
+};
+
+struct result_t {
+	int64_t init, first;
+	int glyphs;        /* decoded by first screen */
+	int width, height; /* cell size */
+};
+
+static void cold_start(struct result_t *rp, const char *path)
+{
+	int i, n;
+	uint32_t code;
+	int64_t start;
+	struct font_t font;
+
+	start = now_ns();
+	font_init(&font, path, 1);
+	rp->init = now_ns() - start;
+
+	/* other codes are taken from compiled-in table: spread over it */
+	start = now_ns();
+	for (code = SPACE, n = 0; code < DEL; code++, n++)
+		get_glyph(&font, code);
+	for (i = 0; i < OTHER_CODES; i++) {
+		code = glyph_code[(long) i * GLYPH_CODES / OTHER_CODES];
+		if (glyph_width(&font, code) > 0) {
+			get_glyph(&font, code);
+			n++;
+		}
+	}
+	rp->first  = now_ns() - start;
+	rp->glyphs = n;
+	rp->width  = font.width;
+	rp->height = font.height;
+
+	font_die(&font);
+}
+
+static void bench(const char *name, const char *path)
+{
+	int i;
+	struct result_t best, r;
+
+	best.init = best.first = INT64_MAX;
+	for (i = 0; i < RUNS; i++) {
+		cold_start(&r, path);
+		if (r.init < best.init)
+			best.init = r.init;
+		if (r.first < best.first)
+			best.first = r.first;
+	}
+	printf("%-24s %5dx%-3d %8d %10.1f %10.1f %10.1f\n", name, r.width, r.height, r.glyphs,
+		best.init / 1e3, best.first / 1e3, (best.init + best.first) / 1e3);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, n;
+	uint32_t code, *codes;
+	char path[2][32] = { "/tmp/fontbench-XXXXXX", "/tmp/fontbench-XXXXXX" };
+
+	printf("%-24s %9s %8s %10s %10s %10s\n", "font", "cell", "glyphs", "init(us)", "first(us)", "total(us)");
+	bench("compiled-in", NULL);
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			bench(argv[i], argv[i]);
+		return EXIT_SUCCESS;
+	}
+
+	/* same codes as compiled-in */
+	codes = (uint32_t *) ecalloc(UCS2_CHARS, sizeof(uint32_t));
+	for (i = 0; i < GLYPH_CODES; i++)
+		codes[i] = glyph_code[i];
+	eclose(mkstemp(path[0]));
+	write_psf2(path[0], PSF2_WIDTH, PSF2_HEIGHT, codes, GLYPH_CODES);
+
+	/* whole BMP except control chars and surrogates */
+	for (code = SPACE, n = 0; code < UCS2_CHARS; code++) {
+		if (code != DEL && (code < 0xD800 || code > 0xDFFF))
+			codes[n++] = code;
+	}
+	eclose(mkstemp(path[1]));
+	write_psf2(path[1], PSF2_WIDTH, PSF2_HEIGHT, codes, n);
+	free(codes);
+
+	bench("psf2 (compiled-in codes)", path[0]);
+	bench("psf2 (BMP)", path[1]);
+
+	unlink(path[0]);
+	unlink(path[1]);
+	return EXIT_SUCCESS;
+}
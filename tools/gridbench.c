@@ -0,0 +1,241 @@
+/* See LICENSE for licence details. */
+/*
+	gridbench: compare cell layouts: array of struct cell_t (AoS, before struct grid_t) and planes (SoA, struct grid_t)
+
+	$ make gridbench
+	$ ./gridbench [ops [cols lines]]
+
+	- screen (default 80x24) is written by terminal with colored text and wide chars,
+	  then its cells are copied to both layouts
+	- same random operations (default 200000 of each kind) are run on both layouts:
+	  scroll: region moves up 1 to lines / 2 lines and blank lines come in (flush_scroll())
+	  erase : style counts of random range of one line are decremented and range becomes blank (fill_cells())
+	  hash  : line hash is summed from cell hashes (rehash_line())
+	  scan  : cells of one style are counted over screen (set_palette(), style recount)
+	- only layout is compared: SoA kernels use grid_*() of terminal.h, AoS kernels are loops over struct cell_t
+	  (blank_hash() cache of fill_cells() is not used by either)
+	- both layouts must have same cells after all operations
+*/
+#include "tool.h"
+
+enum {
+	OPS       = 200000,
+	COLS      = 80,
+	LINES     = 24,
+	MAX_BATCH = 1024, /* max lines */
+};
+
+enum kernel_t {
+	KERNEL_SCROLL = 0,
+	KERNEL_ERASE,
+	KERNEL_HASH,
+	KERNEL_SCAN,
+	KERNELS,
+};
+
+static const char *kernel_name[] = { "scroll", "erase", "hash", "scan" };
+
+struct bench_t {
+	struct terminal *term;
+	int cols, lines;
+	struct cell_t blank;
+	int *count;           /* style usage count (changed by erase) */
+	uint64_t sum;         /* result of hash and scan: both layouts must give same sum */
+};
+
+static void aos_op(struct bench_t *bp, struct cell_t *cells, enum kernel_t kernel, int a, int b)
+{
+	int x, cols = bp->cols;
+	struct cell_t *line;
+
+	switch (kernel) {
+	case KERNEL_SCROLL: /* a: lines */
+		memmove(cells, cells + a * cols, sizeof(struct cell_t) * (bp->lines - a) * cols);
+		for (x = (bp->lines - a) * cols; x < bp->lines * cols; x++)
+			cells[x] = bp->blank;
+		break;
+	case KERNEL_ERASE: /* a: line, b: first column (range is b to cols - 1) */
+		line = cells + a * cols;
+		for (x = b; x < cols; x++)
+			bp->count[line[x].style]--;
+		for (x = b; x < cols; x++)
+			line[x] = bp->blank;
+		bp->count[bp->blank.style] += cols - b;
+		break;
+	case KERNEL_HASH: /* a: line */
+		line = cells + a * cols;
+		for (x = 0; x < cols; x++)
+			bp->sum += cell_hash(bp->term, line[x].code, line[x].style, line[x].width, x);
+		break;
+	case KERNEL_SCAN: /* a: style */
+		for (x = 0; x < bp->lines * cols; x++)
+			bp->sum += (cells[x].style == a);
+		break;
+	default:
+		break;
+	}
+}
+
+static void soa_op(struct bench_t *bp, struct grid_t *grid, enum kernel_t kernel, int a, int b)
+{
+	int x, cols = bp->cols;
+	struct grid_t line;
+
+	switch (kernel) {
+	case KERNEL_SCROLL:
+		grid_move(grid, 0, grid, a * cols, (bp->lines - a) * cols);
+		grid_fill(grid, (bp->lines - a) * cols, a * cols, &bp->blank);
+		break;
+	case KERNEL_ERASE:
+		line = grid_at(grid, a * cols);
+		for (x = b; x < cols; x++)
+			bp->count[line.style[x]]--;
+		grid_fill(&line, b, cols - b, &bp->blank);
+		bp->count[bp->blank.style] += cols - b;
+		break;
+	case KERNEL_HASH:
+		line = grid_at(grid, a * cols);
+		for (x = 0; x < cols; x++)
+			bp->sum += grid_hash(bp->term, &line, x);
+		break;
+	case KERNEL_SCAN:
+		for (x = 0; x < bp->lines * cols; x++)
+			bp->sum += (grid->style[x] == a);
+		break;
+	default:
+		break;
+	}
+}
+
+/* same operations (by seed) on one layout: return elapsed time (ns)
+	operations are timed in batches of lines, then scrolled or erased screen is written again (not timed) */
+static int64_t run(struct bench_t *bp, struct cell_t *cells, struct grid_t *grid, enum kernel_t kernel, int ops)
+{
+	int i, j, n, arg[2][MAX_BATCH];
+	int64_t start, total = 0;
+	struct cell_t cell;
+
+	rnd_seed(kernel + 1);
+	for (i = 0; i < ops; i += n) {
+		n = (ops - i < bp->lines) ? ops - i: bp->lines;
+		for (j = 0; j < n; j++) {
+			if (kernel == KERNEL_SCROLL)
+				arg[0][j] = 1 + rnd(bp->lines / 2);
+			else if (kernel == KERNEL_SCAN)
+				arg[0][j] = rnd(bp->term->style.size);
+			else
+				arg[0][j] = rnd(bp->lines);
+			arg[1][j] = rnd(bp->cols);
+		}
+
+		start = now_ns();
+		for (j = 0; j < n; j++) {
+			if (cells != NULL)
+				aos_op(bp, cells, kernel, arg[0][j], arg[1][j]);
+			else
+				soa_op(bp, grid, kernel, arg[0][j], arg[1][j]);
+		}
+		total += now_ns() - start;
+
+		for (j = 0; kernel <= KERNEL_ERASE && j < bp->lines * bp->cols; j++) {
+			cell = grid_cell(&bp->term->cells, j);
+			if (cells != NULL)
+				cells[j] = cell;
+			else
+				grid_put(grid, j, &cell);
+		}
+	}
+	return total;
+}
+
+/* colored text and wide chars on whole screen */
+static void fill_screen(struct terminal *term)
+{
+	int y, x;
+	char buf[BUFSIZE];
+
+	for (y = 0; y < term->lines; y++) {
+		set_cursor(term, y, 0);
+		for (x = 0; x < term->cols; ) {
+			snprintf(buf, sizeof(buf), "\033[%d;%dm", 30 + rnd(8), 40 + rnd(8));
+			parse(term, (uint8_t *) buf, strlen(buf));
+			if (rnd(4) == 0 && x + 1 < term->cols) {
+				parse(term, (uint8_t *) "\xE6\xBC\xA2", 3);
+				x += WIDE;
+			}
+			else {
+				buf[0] = '!' + rnd(94);
+				parse(term, (uint8_t *) buf, 1);
+				x += HALF;
+			}
+		}
+	}
+	flush_scroll(term);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, k, failed = 0;
+	int ops   = (argc > 1) ? atoi(argv[1]): OPS;
+	int cols  = (argc > 3) ? atoi(argv[2]): COLS;
+	int lines = (argc > 3) ? atoi(argv[3]): LINES;
+	int64_t t[2];
+	uint64_t sum[2];
+	struct cell_t *cells, cell;
+	struct grid_t grid;
+	struct terminal term;
+	struct bench_t bench;
+
+	if (lines > MAX_BATCH)
+		fatal("too many lines\n");
+
+	open_term(&term, cols, lines);
+	rnd_seed(1);
+	fill_screen(&term);
+
+	bench.term  = &term;
+	bench.cols  = cols;
+	bench.lines = lines;
+	bench.blank = grid_cell(&term.cells, 0);
+	bench.blank.code  = DEFAULT_CHAR;
+	bench.blank.width = HALF;
+	bench.count = (int *) ecalloc(term.style.size, sizeof(int));
+
+	cells = (struct cell_t *) ecalloc(cols * lines, sizeof(struct cell_t));
+	grid_alloc(&grid, cols * lines);
+
+	printf("%dx%d, %d ops: sizeof(struct cell_t) = %d\n", cols, lines, ops, (int) sizeof(struct cell_t));
+	printf("%-8s %10s %10s %8s\n", "kernel", "AoS(ms)", "SoA(ms)", "AoS/SoA");
+	for (k = 0; k < KERNELS; k++) {
+		for (i = 0; i < cols * lines; i++) {
+			cells[i] = grid_cell(&term.cells, i);
+			grid_put(&grid, i, &cells[i]);
+		}
+
+		bench.sum = 0;
+		t[0] = run(&bench, cells, NULL, k, ops);
+		sum[0] = bench.sum;
+
+		bench.sum = 0;
+		t[1] = run(&bench, NULL, &grid, k, ops);
+		sum[1] = bench.sum;
+
+		printf("%-8s %10.1f %10.1f %8.2f\n", kernel_name[k], t[0] / 1e6, t[1] / 1e6, (double) t[0] / t[1]);
+
+		for (i = 0; i < cols * lines; i++) {
+			cell = grid_cell(&grid, i);
+			if (cells[i].code != cell.code || cells[i].style != cell.style || cells[i].width != cell.width)
+				break;
+		}
+		if (i < cols * lines || sum[0] != sum[1]) {
+			fprintf(stderr, "%s: layouts differ\n", kernel_name[k]);
+			failed++;
+		}
+	}
+
+	grid_free(&grid);
+	free(cells);
+	free(bench.count);
+	close_term(&term);
+	return (failed > 0) ? EXIT_FAILURE: EXIT_SUCCESS;
+}
@@ -0,0 +1,249 @@
+/* See LICENSE for licence details. */
+/*
+	mkglyph: convert BDF fonts to compact glyph table (jni/glyph.h)
+
+	$ gcc -o mkglyph tools/mkglyph.c
+	$ ./mkglyph [-a alias] font1.bdf [font2.bdf ...] > jni/glyph.h
+
+	- glyph of later font overrides earlier one (only UCS2 code points are used)
+	- cell width: DWIDTH of U+0020, cell height: max FONT_ASCENT + FONT_DESCENT
+	- glyph wider than cell width is wide (double width) glyph
+	- alias file: each line "dst src" (hex code point), copy glyph of src to dst
+
+	output layout:
+	- narrow_bitmap[] and wide_bitmap[]: deduplicated bitmaps,
+	  each row is MSB first (leftmost pixel is MSB of ceil(width / 8) bytes)
+	- glyph_code[] (sorted) and glyph_ref[]: code point -> bitmap number
+	  (glyph_ref < NARROW_GLYPHS: narrow_bitmap[], others: wide_bitmap[glyph_ref - NARROW_GLYPHS])
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+	UCS2_CHARS = 0x10000,
+	MAX_HEIGHT = 64,
+	MAX_WIDTH  = 32,  /* of wide glyph */
+	BUFSIZE    = 1024,
+};
+
+struct bdf_glyph_t {
+	bool defined;
+	int dwidth;
+	int width, height, xoff, yoff;  /* BBX */
+	uint32_t rows[MAX_HEIGHT];      /* BBX width bits, MSB first */
+};
+
+struct bitmap_t {
+	int wide;
+	uint32_t rows[MAX_HEIGHT];
+};
+
+static struct bdf_glyph_t glyphs[UCS2_CHARS];
+static uint32_t bitmap_of[UCS2_CHARS]; /* code -> index of bitmaps[] */
+static struct bitmap_t bitmaps[UCS2_CHARS];
+static int cell_width, cell_height, max_ascent, max_descent;
+
+void fatal(const char *str)
+{
+	fprintf(stderr, "mkglyph: %s\n", str);
+	exit(EXIT_FAILURE);
+}
+
+void load_bdf(const char *path)
+{
+	FILE *fp;
+	char buf[BUFSIZE];
+	int ascent = 0, descent = 0, code = -1, row = -1, digits;
+	struct bdf_glyph_t glyph;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		fatal(path);
+
+	while (fgets(buf, BUFSIZE, fp) != NULL) {
+		if (row >= 0) {
+			if (strncmp(buf, "ENDCHAR", 7) == 0) {
+				if (0 <= code && code < UCS2_CHARS) {
+					glyph.defined = true;
+					glyphs[code]  = glyph;
+				}
+				row = -1;
+			}
+			else if (row < MAX_HEIGHT) {
+				/* hex row: left aligned in ceil(width / 8) bytes */
+				digits = strspn(buf, "0123456789ABCDEFabcdef");
+				if (digits * 4 < glyph.width || digits > 8)
+					fatal("invalid BITMAP");
+				glyph.rows[row] = strtoul(buf, NULL, 16) >> (digits * 4 - glyph.width);
+				row++;
+			}
+			continue;
+		}
+
+		if (strncmp(buf, "FONT_ASCENT ", 12) == 0)
+			ascent = atoi(buf + 12);
+		else if (strncmp(buf, "FONT_DESCENT ", 13) == 0)
+			descent = atoi(buf + 13);
+		else if (strncmp(buf, "STARTCHAR", 9) == 0)
+			memset(&glyph, 0, sizeof(struct bdf_glyph_t));
+		else if (strncmp(buf, "ENCODING ", 9) == 0)
+			code = atoi(buf + 9);
+		else if (strncmp(buf, "DWIDTH ", 7) == 0)
+			glyph.dwidth = atoi(buf + 7);
+		else if (strncmp(buf, "BBX ", 4) == 0) {
+			if (sscanf(buf + 4, "%d %d %d %d", &glyph.width, &glyph.height, &glyph.xoff, &glyph.yoff) != 4
+				|| glyph.width > MAX_WIDTH || glyph.height > MAX_HEIGHT)
+				fatal("invalid BBX");
+		}
+		else if (strncmp(buf, "BITMAP", 6) == 0)
+			row = 0;
+	}
+	fclose(fp);
+
+	if (ascent > max_ascent)
+		max_ascent = ascent;
+	if (descent > max_descent)
+		max_descent = descent;
+}
+
+void load_alias(const char *path)
+{
+	FILE *fp;
+	char buf[BUFSIZE];
+	unsigned int dst, src;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		fatal(path);
+
+	while (fgets(buf, BUFSIZE, fp) != NULL) {
+		if (sscanf(buf, "%x %x", &dst, &src) != 2
+			|| dst >= UCS2_CHARS || src >= UCS2_CHARS || !glyphs[src].defined)
+			continue;
+		glyphs[dst] = glyphs[src];
+	}
+	fclose(fp);
+}
+
+/* render glyph into cell: row is MSB first in ceil(pitch / 8) bytes */
+void render(struct bdf_glyph_t *gp, struct bitmap_t *bp)
+{
+	int x, y, pitch, bits, top;
+
+	memset(bp, 0, sizeof(struct bitmap_t));
+	bp->wide = (gp->dwidth > cell_width) ? 1: 0;
+	pitch    = cell_width * (bp->wide + 1);
+	bits     = (pitch + 7) / 8 * 8;
+	top      = max_ascent - (gp->yoff + gp->height); /* baseline is shared by all fonts */
+
+	for (y = 0; y < gp->height; y++) {
+		if (top + y < 0 || top + y >= cell_height)
+			continue;
+		for (x = 0; x < gp->width; x++) {
+			if (gp->xoff + x < 0 || gp->xoff + x >= pitch)
+				continue;
+			if (gp->rows[y] & (1u << (gp->width - 1 - x)))
+				bp->rows[top + y] |= 1u << (bits - 1 - (gp->xoff + x));
+		}
+	}
+}
+
+void print_bitmaps(const char *type, const char *name, int wide, int count)
+{
+	int i, y, n = 0;
+
+	printf("static const %s %s[][CELL_HEIGHT] = {\n", type, name);
+	for (i = 0; i < count; i++) {
+		if (bitmaps[i].wide != wide)
+			continue;
+		printf("\t{");
+		for (y = 0; y < cell_height; y++)
+			printf("0x%X%s", bitmaps[i].rows[y], (y == cell_height - 1) ? "": ", ");
+		printf("},\n");
+		n++;
+	}
+	if (n == 0)
+		printf("\t{0},\n");
+	printf("};\n\n");
+}
+
+const char *row_type(int pitch)
+{
+	return (pitch <= 8) ? "uint8_t": (pitch <= 16) ? "uint16_t": "uint32_t";
+}
+
+void print_index(const char *name, bool ref)
+{
+	int code, n = 0;
+
+	printf("static const uint16_t %s[GLYPH_CODES] = {", name);
+	for (code = 0; code < UCS2_CHARS; code++) {
+		if (!glyphs[code].defined)
+			continue;
+		printf("%s%d,", (n % 16 == 0) ? "\n\t": " ", ref ? (int) bitmap_of[code]: code);
+		n++;
+	}
+	printf("\n};\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int i, j, arg = 1, count = 0, codes = 0, narrow = 0;
+	uint32_t code;
+	struct bitmap_t bitmap;
+
+	if (argc >= 3 && strcmp(argv[1], "-a") == 0)
+		arg = 3;
+	if (arg >= argc)
+		fatal("usage: mkglyph [-a alias] font1.bdf [font2.bdf ...]");
+
+	for (i = arg; i < argc; i++)
+		load_bdf(argv[i]);
+	if (arg == 3)
+		load_alias(argv[2]);
+
+	if (!glyphs[0x20].defined)
+		fatal("cannot find U+0020 (SPACE)");
+	cell_width  = glyphs[0x20].dwidth;
+	cell_height = max_ascent + max_descent;
+	if (cell_width <= 0 || cell_width * 2 > MAX_WIDTH || cell_height <= 0 || cell_height > MAX_HEIGHT)
+		fatal("unsupported cell size");
+
+	/* deduplicate: narrow bitmaps first, then wide bitmaps */
+	for (j = 0; j < 2; j++) {
+		for (code = 0; code < UCS2_CHARS; code++) {
+			if (!glyphs[code].defined)
+				continue;
+			render(&glyphs[code], &bitmap);
+			if (bitmap.wide != j)
+				continue;
+
+			for (i = 0; i < count; i++)
+				if (memcmp(&bitmaps[i], &bitmap, sizeof(struct bitmap_t)) == 0)
+					break;
+			if (i == count)
+				bitmaps[count++] = bitmap;
+			bitmap_of[code] = i;
+			codes++;
+		}
+		if (j == 0)
+			narrow = count;
+	}
+
+	printf("/* this file was created by tools/mkglyph.c: do not edit */\n\n");
+	printf("enum {\n");
+	printf("\tCELL_WIDTH    = %d,\n", cell_width);
+	printf("\tCELL_HEIGHT   = %d,\n", cell_height);
+	printf("\tNARROW_GLYPHS = %d, /* glyph_ref[] >= NARROW_GLYPHS: wide glyph */\n", narrow);
+	printf("\tGLYPH_CODES   = %d,\n", codes);
+	printf("};\n\n");
+
+	print_bitmaps(row_type(cell_width), "narrow_bitmap", 0, count);
+	print_bitmaps(row_type(cell_width * 2), "wide_bitmap", 1, count);
+	print_index("glyph_code", false);
+	printf("\n");
+	print_index("glyph_ref", true);
+
+	return 0;
+}
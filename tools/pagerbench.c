@@ -0,0 +1,204 @@
+/* See LICENSE for licence details. */
+/*
+	pagerbench: replay pager scrolling through refresh() and report rendered line cache (cache.h) statistics
+
+	$ make pagerbench
+	$ ./pagerbench [keys [cols lines]]
+
+	- document of colored source like lines (some blank, some with wide chars) is shown by less like pager
+	  on cols x lines terminal (default 80x24): last line is prompt
+	- each key (default 5000) is one frame (refresh()): line down 60%, line up 20%, page down 10%, page up 10%
+	  line down: new line at bottom scrolls screen up (LF)
+	  line up  : new line at top scrolls screen down (RI)
+	  page down: lines - 1 new lines scroll screen up
+	  page up  : screen is cleared and repainted (ED)
+	- trace is replayed with line cache (LINE_CACHE_SIZE) and without cache:
+	  copy buffers must be same, hits/misses are counters of struct line_cache_t
+	- native window is malloc'ed buffer of RGBA_8888 (tools/stub/): no device or DEBUG build is needed
+*/
+#include "tool.h"
+#include "cache.h"
+#include "android.h"
+
+enum {
+	KEYS      = 5000,
+	COLS      = 80,
+	LINES     = 24,
+	DOC_LINES = 3000,
+};
+
+/* document line: same line number gives same bytes */
+static int doc_line(char *buf, int cols, int num)
+{
+	static const char *keyword[] = { "static", "int", "return", "if", "for", "struct", "void" };
+	static const char *ident[] = { "term", "fb", "line", "cols", "cache", "hash", "strip", "x", "y" };
+	int len = 0, x, n, indent;
+
+	rnd_seed(num + 1);
+	if (rnd(6) == 0) /* blank */
+		return 0;
+
+	indent = rnd(4);
+	for (x = 0; x < indent * 4; x++)
+		buf[len++] = ' ';
+
+	while (x < cols - 16) {
+		switch (rnd(5)) {
+		case 0:
+			n = sprintf(buf + len, "\033[1;34m%s\033[m ", keyword[rnd(sizeof(keyword) / sizeof(keyword[0]))]);
+			x += n - 10;
+			break;
+		case 1:
+			n = sprintf(buf + len, "\033[32m\"%s\"\033[m", ident[rnd(sizeof(ident) / sizeof(ident[0]))]);
+			x += n - 8;
+			break;
+		case 2:
+			if (rnd(4) == 0) {
+				n = sprintf(buf + len, "/* \xE6\xBC\xA2\xE5\xAD\x97 */ ");
+				x += 11;
+				break;
+			}
+			/* fall through */
+		default:
+			n = sprintf(buf + len, "%s ", ident[rnd(sizeof(ident) / sizeof(ident[0]))]);
+			x += n;
+			break;
+		}
+		len += n;
+		if (rnd(4) == 0)
+			break;
+	}
+	return len;
+}
+
+/* append document line num (or blank line past end) */
+static int put_doc(char *buf, int cols, int num)
+{
+	return (num < DOC_LINES) ? doc_line(buf, cols, num): 0;
+}
+
+/* output of pager for one key: return length */
+static int pager_key(char *buf, int cols, int lines, int *top, uint32_t key)
+{
+	int i, len = 0, page = lines - 1;
+
+	if (key < 60 || (key >= 80 && key < 90)) { /* line down, page down */
+		for (i = (key < 60) ? 1: page; i > 0 && *top + page < DOC_LINES; i--) {
+			len += sprintf(buf + len, "\033[%d;1H\033[K", lines);
+			len += put_doc(buf + len, cols, *top + page);
+			len += sprintf(buf + len, "\r\n");
+			(*top)++;
+		}
+	}
+	else if (key < 80) { /* line up */
+		if (*top > 0) {
+			(*top)--;
+			len += sprintf(buf + len, "\033[H\033M");
+			len += put_doc(buf + len, cols, *top);
+		}
+	}
+	else { /* page up */
+		*top = (*top > page) ? *top - page: 0;
+		len += sprintf(buf + len, "\033[H\033[2J");
+		for (i = 0; i < page; i++) {
+			len += sprintf(buf + len, "\033[%d;1H", i + 1);
+			len += put_doc(buf + len, cols, *top + i);
+		}
+	}
+	len += sprintf(buf + len, "\033[%d;1H\033[K:", lines);
+	return len;
+}
+
+struct result_t {
+	int64_t time;
+	unsigned long drawn, skipped, hits, misses, posts;
+	unsigned char *buf; /* copy buffer after last frame */
+};
+
+static void replay(struct result_t *rp, int keys, int cols, int lines, bool use_cache)
+{
+	int i, len, top = 0;
+	uint32_t key, state;
+	char *buf;
+	int64_t start;
+	ANativeWindow window;
+	struct android_app app;
+	struct framebuffer fb;
+	struct terminal term;
+
+	/* fb_init() takes offset (0, 40) from window */
+	window.width  = cols * CELL_WIDTH;
+	window.height = lines * CELL_HEIGHT + 40;
+	window.format = WINDOW_FORMAT_RGBA_8888;
+	window.bits   = ecalloc(window.width * window.height, 4);
+	window.posts  = 0;
+	app.window    = &window;
+
+	fb.app = &app;
+	fb_init(&fb);
+	open_term(&term, cols, lines);
+
+	if (!use_cache) /* refresh() keeps cache of same strip size */
+		cache_init(&fb.cache, term.cols * term.font.width * term.font.height * fb.surface_bpp, 0);
+
+	buf = (char *) ecalloc(lines * (cols * 4 + BUFSIZE), 1);
+	len = pager_key(buf, cols, lines, &top, 90); /* first page */
+
+	state = 1;
+	start = now_ns();
+	for (i = 0; i <= keys; i++) {
+		parse(&term, (uint8_t *) buf, len);
+		refresh(&fb, &term);
+
+		/* keys have own random stream: doc_line() reseeds rnd() */
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		key = state % 100;
+		len = pager_key(buf, cols, lines, &top, key);
+	}
+	rp->time    = now_ns() - start;
+	rp->drawn   = fb.lines_drawn;
+	rp->skipped = fb.lines_skipped;
+	rp->hits    = fb.cache.hits;
+	rp->misses  = fb.cache.misses;
+	rp->posts   = window.posts;
+	rp->buf     = (unsigned char *) ecalloc(fb.screen_size, 1);
+	memcpy(rp->buf, fb.buf, fb.screen_size);
+
+	free(buf);
+	close_term(&term);
+	fb_die(&fb);
+	free(window.bits);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, failed = 0;
+	int keys  = (argc > 1) ? atoi(argv[1]): KEYS;
+	int cols  = (argc > 3) ? atoi(argv[2]): COLS;
+	int lines = (argc > 3) ? atoi(argv[3]): LINES;
+	size_t size = (size_t) cols * CELL_WIDTH * (lines * CELL_HEIGHT + 40) * 4;
+	struct result_t result[2];
+	const char *name[] = { "cache", "no cache" };
+
+	printf("%dx%d, %d keys\n", cols, lines, keys);
+	printf("%-9s %9s %9s %9s %9s %9s %8s %10s\n",
+		"", "posts", "drawn", "skipped", "hits", "misses", "hit rate", "time(ms)");
+	for (i = 0; i < 2; i++) {
+		replay(&result[i], keys, cols, lines, i == 0);
+		printf("%-9s %9lu %9lu %9lu %9lu %9lu %7.1f%% %10.1f\n", name[i],
+			result[i].posts - 1, result[i].drawn, result[i].skipped, result[i].hits, result[i].misses,
+			(result[i].hits + result[i].misses > 0) ?
+				100.0 * result[i].hits / (result[i].hits + result[i].misses): 0.0,
+			result[i].time / 1e6);
+	}
+
+	if (memcmp(result[0].buf, result[1].buf, size) != 0) {
+		fprintf(stderr, "copy buffer differs between cache and no cache\n");
+		failed++;
+	}
+	free(result[0].buf);
+	free(result[1].buf);
+	return (failed > 0) ? EXIT_FAILURE: EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/* See LICENSE for licence details. */
+/*
+	replay: time parse() of output streams with CSI fast path (csi_fast()) and with general path only
+
+	$ make replay
+	$ ./replay [file...]
+
+	- without file, two generated streams are replayed (same bytes on any host):
+	  tui: full screen redraws of TUI (CUP, SGR, EL and some ED), 3.2MB
+	  log: colored ls and git log like output (SGR and CR/LF), 1.9MB
+	- recorded stream can be replayed too: e.g. "script -q -c htop htop.log" then "./replay htop.log"
+	- stream is parsed in chunks of READ_BUFSIZE (as read from pty) by 80x24 terminal, best of 5 runs
+	- general path: chunk is also ended just after each ESC, so csi_fast() never sees complete sequence
+	  (plain text never spans ESC: scroll-off elision is same in both paths)
+	- terminal state after both paths must be same
+*/
+#include "tool.h"
+
+enum {
+	COLS     = 80,
+	LINES    = 24,
+	RUNS     = 5,
+	TUI_SIZE = 3200 * 1000,
+	LOG_SIZE = 1900 * 1000,
+};
+
+struct stream_t {
+	const char *name;
+	uint8_t *buf;
+	int size;
+};
+
+static const char *word[] = {
+	"src", "include", "Makefile", "README", "yaft.c", "terminal", "parse", "fix", "add",
+	"update", "scroll", "cache", "font", "\xE6\xBC\xA2\xE5\xAD\x97", "\xE3\x81\x82",
+};
+
+static int put_word(uint8_t *buf)
+{
+	return sprintf((char *) buf, "%s", word[rnd(sizeof(word) / sizeof(word[0]))]);
+}
+
+/* TUI: each frame moves cursor to each line and redraws some segments of it */
+static int gen_tui(uint8_t *buf, int size)
+{
+	static const char *sgr[] = {
+		"\033[m", "\033[0m", "\033[1m", "\033[7m", "\033[1;33m", "\033[0;37;44m",
+		"\033[38;5;208m", "\033[30;47m", "\033[1;32;40m",
+	};
+	int len = 0, y, x, n;
+
+	while (len < size - BUFSIZE * LINES) {
+		len += sprintf((char *) buf + len, (rnd(16) == 0) ? "\033[H\033[2J": "\033[H");
+		for (y = 1; y <= LINES; y++) {
+			if (rnd(3) == 0) /* line not changed */
+				continue;
+			len += sprintf((char *) buf + len, "\033[%d;%dH", y, 1 + rnd(COLS / 4));
+			for (x = rnd(6); x >= 0; x--) {
+				len += sprintf((char *) buf + len, "%s", sgr[rnd(sizeof(sgr) / sizeof(sgr[0]))]);
+				for (n = rnd(4); n >= 0; n--) {
+					len += put_word(buf + len);
+					buf[len++] = ' ';
+				}
+			}
+			len += sprintf((char *) buf + len, "\033[m\033[K");
+		}
+		len += sprintf((char *) buf + len, "\033[%d;%dH", LINES, 1 + rnd(COLS));
+	}
+	return len;
+}
+
+/* ls --color and git log --color: short SGR around words, lines end with CR/LF */
+static int gen_log(uint8_t *buf, int size)
+{
+	int len = 0, i, n;
+
+	while (len < size - BUFSIZE) {
+		switch (rnd(4)) {
+		case 0: /* ls: directories, executables and plain files */
+			for (n = 1 + rnd(5); n > 0; n--) {
+				len += sprintf((char *) buf + len, "%s", (rnd(2) == 0) ? "\033[01;34m": "\033[01;32m");
+				len += put_word(buf + len);
+				len += sprintf((char *) buf + len, "\033[0m  ");
+				len += put_word(buf + len);
+				len += sprintf((char *) buf + len, "  ");
+			}
+			break;
+		case 1: /* git log: commit line */
+			len += sprintf((char *) buf + len, "\033[33mcommit %.8x%.8x\033[m", rnd(INT_MAX), rnd(INT_MAX));
+			if (rnd(2) == 0)
+				len += sprintf((char *) buf + len, "\033[33m (\033[1;36mHEAD\033[m\033[33m)\033[m");
+			break;
+		default: /* git log: message or diffstat */
+			len += sprintf((char *) buf + len, "    ");
+			for (n = 2 + rnd(8); n > 0; n--) {
+				len += put_word(buf + len);
+				buf[len++] = ' ';
+			}
+			if (rnd(3) == 0) {
+				len += sprintf((char *) buf + len, "| %d \033[32m", 1 + rnd(99));
+				for (i = rnd(10); i >= 0; i--)
+					buf[len++] = '+';
+				len += sprintf((char *) buf + len, "\033[31m--\033[m");
+			}
+			break;
+		}
+		len += sprintf((char *) buf + len, "\r\n");
+	}
+	return len;
+}
+
+static void load_stream(struct stream_t *sp, const char *path)
+{
+	int fd;
+	struct stat st;
+
+	fd = eopen(path, O_RDONLY);
+	if (fstat(fd, &st) < 0)
+		fatal("fstat");
+
+	sp->name = path;
+	sp->size = st.st_size;
+	sp->buf  = (uint8_t *) ecalloc(sp->size + 1, 1);
+	if (read(fd, sp->buf, sp->size) != sp->size)
+		fatal("read");
+	eclose(fd);
+}
+
+/* return elapsed time (ns) of parse(): terminal is kept open for compare_term() */
+static int64_t replay(struct terminal *term, struct stream_t *sp, bool general)
+{
+	int i, n;
+	int64_t start;
+	uint8_t *esc;
+
+	open_term(term, COLS, LINES);
+
+	start = now_ns();
+	for (i = 0; i < sp->size; i += n) {
+		n = (sp->size - i < READ_BUFSIZE) ? sp->size - i: READ_BUFSIZE;
+		if (general && (esc = (uint8_t *) memchr(sp->buf + i, ESC, n)) != NULL)
+			n = esc - (sp->buf + i) + 1;
+		parse(term, sp->buf + i, n);
+	}
+	flush_scroll(term);
+	return now_ns() - start;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, j, k, streams, failed = 0;
+	int64_t t, best[2];
+	struct stream_t *stream;
+	static struct terminal term[2];
+
+	if (argc > 1) {
+		streams = argc - 1;
+		stream  = (struct stream_t *) ecalloc(streams, sizeof(struct stream_t));
+		for (i = 0; i < streams; i++)
+			load_stream(&stream[i], argv[i + 1]);
+	}
+	else {
+		streams = 2;
+		stream  = (struct stream_t *) ecalloc(streams, sizeof(struct stream_t));
+		stream[0].name = "tui";
+		stream[0].buf  = (uint8_t *) ecalloc(TUI_SIZE, 1);
+		rnd_seed(1);
+		stream[0].size = gen_tui(stream[0].buf, TUI_SIZE);
+		stream[1].name = "log";
+		stream[1].buf  = (uint8_t *) ecalloc(LOG_SIZE, 1);
+		rnd_seed(2);
+		stream[1].size = gen_log(stream[1].buf, LOG_SIZE);
+	}
+
+	printf("%-16s %10s %10s %12s %8s\n", "stream", "bytes", "fast(ms)", "general(ms)", "ratio");
+	for (i = 0; i < streams; i++) {
+		for (j = 0; j < 2; j++) {
+			best[j] = INT64_MAX;
+			for (k = 0; k < RUNS; k++) {
+				if ((t = replay(&term[j], &stream[i], j == 1)) < best[j])
+					best[j] = t;
+				if (k < RUNS - 1)
+					close_term(&term[j]);
+			}
+		}
+		printf("%-16s %10d %10.1f %12.1f %8.2f\n", stream[i].name, stream[i].size,
+			best[0] / 1e6, best[1] / 1e6, (double) best[1] / best[0]);
+
+		if (compare_term(&term[1], &term[0]) > 0) {
+			fprintf(stderr, "%s: terminal state differs between fast and general path\n", stream[i].name);
+			failed++;
+		}
+		close_term(&term[0]);
+		close_term(&term[1]);
+		free(stream[i].buf);
+	}
+	free(stream);
+	return (failed > 0) ? EXIT_FAILURE: EXIT_SUCCESS;
+}
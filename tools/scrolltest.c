@@ -0,0 +1,213 @@
+/* See LICENSE for licence details. */
+/*
+	scrolltest: check deferred scroll (see scroll() and flush_scroll()) against eager scroll on host
+
+	$ make scrolltest
+	$ ./scrolltest [streams [seed]]
+
+	- random streams mix LF/RI/IND/NEL, SU/SD, IL/DL, margins, origin mode,
+	  wide chars, colors, palette changes and erase/insert/delete
+	- reference terminal parses stream byte by byte and calls flush_scroll() after each byte
+	  (each scroll is applied at once), others parse it in chunks (scrolls are deferred and coalesced)
+	- cells, cursor, line hashes and style usage counts must be same as reference
+	- each stream is run with compiled-in font and with PSF2 font (written to /tmp)
+	  that has glyph of SUBSTITUTE_WIDE: wide char must move cursor two columns with both
+	- android headers are replaced by stubs (tools/stub/), framebuffer (android.h) is not built
+*/
+#include "tool.h"
+
+enum {
+	STREAM_SIZE = 64 * 1024,
+	STREAMS     = 60,
+};
+
+static const int chunk_size[] = { 13, 1000, STREAM_SIZE };
+
+static const struct { int cols, lines; } term_size[] = {
+	{ 80, 24 }, { 20, 6 }, { 7, 3 },
+};
+
+/* random stream: mostly text and line feeds, some scrolls and other sequences */
+static int gen_stream(char *buf, int size, int lines)
+{
+	static const char *wide[] = { "\xE6\xBC\xA2", "\xE5\xAD\x97", "\xE3\x81\x82" };
+	int len = 0, n;
+
+	while (len < size - BUFSIZE) {
+		switch (rnd(24)) {
+		case 0: case 1: case 2: case 3: case 4: case 5:
+			for (n = rnd(40); n > 0; n--)
+				buf[len++] = ' ' + rnd(95);
+			break;
+		case 6:
+			len += sprintf(buf + len, "%s", wide[rnd(3)]);
+			break;
+		case 7: case 8: case 9:
+			len += sprintf(buf + len, "\r\n");
+			break;
+		case 10:
+			len += sprintf(buf + len, "\n");
+			break;
+		case 11: /* RI, IND, NEL */
+			len += sprintf(buf + len, "\033%c", "MDE"[rnd(3)]);
+			break;
+		case 12: /* SU, SD (larger than region too) */
+			len += sprintf(buf + len, "\033[%d%c", rnd(lines * 2), "ST"[rnd(2)]);
+			break;
+		case 13: /* IL, DL */
+			len += sprintf(buf + len, "\033[%d%c", rnd(lines), "LM"[rnd(2)]);
+			break;
+		case 14: /* DECSTBM */
+			if (rnd(4) == 0)
+				len += sprintf(buf + len, "\033[r");
+			else
+				len += sprintf(buf + len, "\033[%d;%dr", 1 + rnd(lines), 1 + rnd(lines));
+			break;
+		case 15: /* DECOM */
+			len += sprintf(buf + len, "\033[?6%c", "hl"[rnd(2)]);
+			break;
+		case 16: /* CUP */
+			len += sprintf(buf + len, "\033[%d;%dH", 1 + rnd(lines), 1 + rnd(100));
+			break;
+		case 17: /* SGR */
+			switch (rnd(4)) {
+			case 0: len += sprintf(buf + len, "\033[0m"); break;
+			case 1: len += sprintf(buf + len, "\033[%d;%dm", 30 + rnd(8), 40 + rnd(8)); break;
+			case 2: len += sprintf(buf + len, "\033[38;5;%d;%dm", rnd(COLORS), 1 + rnd(7)); break;
+			case 3: len += sprintf(buf + len, "\033[48;2;%d;%d;%dm", rnd(256), rnd(256), rnd(256)); break;
+			}
+			break;
+		case 18: /* OSC 4 */
+			len += sprintf(buf + len, "\033]4;%d;rgb:%.2X/%.2X/%.2X\033\\", rnd(16), rnd(256), rnd(256), rnd(256));
+			break;
+		case 19: /* ED, EL */
+			len += sprintf(buf + len, "\033[%d%c", rnd(3), "JK"[rnd(2)]);
+			break;
+		case 20: /* ICH, DCH, ECH */
+			len += sprintf(buf + len, "\033[%d%c", rnd(10), "@PX"[rnd(3)]);
+			break;
+		case 21: /* DECAWM */
+			len += sprintf(buf + len, "\033[?7%c", "hl"[rnd(4) == 0]);
+			break;
+		case 22: /* burst of line feeds (scroll-off elision) */
+			for (n = rnd(lines * 3); n > 0; n--)
+				len += sprintf(buf + len, "line %d\r\n", n);
+			break;
+		case 23: /* BS, HT */
+			buf[len++] = (rnd(2) == 0) ? BS: HT;
+			break;
+		}
+	}
+	return len;
+}
+
+static void run(struct terminal *term, int cols, int lines, uint8_t *buf, int size, int chunk)
+{
+	int i, n;
+
+	open_term(term, cols, lines);
+
+	for (i = 0; i < size; i += n) {
+		n = (size - i < chunk) ? size - i: chunk;
+		parse(term, buf + i, n);
+		if (chunk == 1) /* eager: each scroll is applied */
+			flush_scroll(term);
+	}
+	flush_scroll(term);
+}
+
+/* usage counts and hashes of one terminal: return number of errors */
+static int check_counts(struct terminal *term)
+{
+	int i, errors = 0, *count;
+	uint64_t hash;
+
+	count = (int *) ecalloc(term->style.size, sizeof(int));
+	for (i = 0; i < term->cols * term->lines; i++)
+		count[term->cells.style[i]]++;
+	for (i = 0; i < term->style.size; i++)
+		errors += (term->style.entry[i].used && term->style.entry[i].cells != count[i]);
+	free(count);
+
+	for (i = 0; i < term->lines; i++) {
+		hash = term->line_hash[i];
+		rehash_line(term, i);
+		errors += (hash != term->line_hash[i]);
+	}
+	return errors;
+}
+
+/* wide char (and its substitute) must take two columns
+	on drawn lines and on lines elided by scroll-off: return number of errors */
+static int check_wide(struct terminal *ref, struct terminal *term)
+{
+	int i, len, errors;
+	char buf[256];
+
+	len = sprintf(buf, "a\xE6\xBC\xA2" "b");
+	run(ref, 10, 2, (uint8_t *) buf, len, 1);
+	errors = (ref->cursor.x != 4 || ref->cells.width[1] != WIDE || ref->cells.width[2] != NEXT_TO_WIDE);
+	close_term(ref);
+
+	/* LF keeps column: cursor after elided lines depends on width of each char */
+	for (len = 0, i = 0; i < 6 * 4; i++)
+		len += sprintf(buf + len, "%s", (i % 4 == 3) ? "\n": "\xE6\xBC\xA2");
+	run(ref, 10, 2, (uint8_t *) buf, len, 1);
+	run(term, 10, 2, (uint8_t *) buf, len, len);
+	errors += compare_term(ref, term);
+	close_term(term);
+	close_term(ref);
+	return errors;
+}
+
+int main(int argc, char *argv[])
+{
+	int i, j, f, size, cols, lines, errors, failed = 0;
+	int streams = (argc > 1) ? atoi(argv[1]): STREAMS;
+	uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 10): 1;
+	static char buf[STREAM_SIZE], psf2_path[] = "/tmp/scrolltest-XXXXXX";
+	static struct terminal ref, term;
+	const char *fonts[] = { NULL, psf2_path };
+	uint32_t code[DEL - SPACE + 1];
+
+	/* printable ASCII and SUBSTITUTE_WIDE */
+	for (i = 0; i < DEL - SPACE; i++)
+		code[i] = SPACE + i;
+	code[i] = SUBSTITUTE_WIDE;
+	eclose(mkstemp(psf2_path));
+	write_psf2(psf2_path, CELL_WIDTH, CELL_HEIGHT, code, DEL - SPACE + 1);
+
+	for (f = 0; f < (int) (sizeof(fonts) / sizeof(fonts[0])); f++) {
+		font_path = fonts[f];
+		if (check_wide(&ref, &term) > 0) {
+			fprintf(stderr, "font %s: wide char does not take two columns\n", fonts[f] ? fonts[f]: "(compiled-in)");
+			failed++;
+		}
+	}
+
+	for (i = 0; i < streams * 2; i++) {
+		font_path = fonts[i % 2];
+		rnd_seed(seed + i / 2 * 2654435761U);
+		cols  = term_size[i / 2 % 3].cols;
+		lines = term_size[i / 2 % 3].lines;
+		size  = gen_stream(buf, STREAM_SIZE, lines);
+
+		run(&ref, cols, lines, (uint8_t *) buf, size, 1);
+		errors = check_counts(&ref);
+		for (j = 0; j < (int) (sizeof(chunk_size) / sizeof(chunk_size[0])); j++) {
+			run(&term, cols, lines, (uint8_t *) buf, size, chunk_size[j]);
+			errors += check_counts(&term) + compare_term(&ref, &term);
+			close_term(&term);
+		}
+		close_term(&ref);
+
+		if (errors > 0) {
+			fprintf(stderr, "stream %d (%dx%d, %d bytes, %s font): %d errors\n",
+				i / 2, cols, lines, size, (i % 2) ? "PSF2": "compiled-in", errors);
+			failed++;
+		}
+	}
+	unlink(psf2_path);
+	printf("scrolltest: %d/%d runs passed\n", streams * 2 + 2 - failed, streams * 2 + 2);
+	return (failed > 0) ? EXIT_FAILURE: EXIT_SUCCESS;
+}
@@ -0,0 +1,2 @@
+/* See LICENSE for licence details. */
+/* host stub of NDK header (for host tools): key codes are in jni/keycode.h */
@@ -0,0 +1,19 @@
+/* See LICENSE for licence details. */
+/* host stub of NDK header (for host tools) */
+#include <stdarg.h>
+#include <stdio.h>
+
+enum { ANDROID_LOG_ERROR = 6, ANDROID_LOG_FATAL = 7 };
+
+static inline int __android_log_print(int prio, const char *tag, const char *fmt, ...)
+{
+	int ret;
+	va_list ap;
+
+	(void) prio;
+	(void) tag;
+	va_start(ap, fmt);
+	ret = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return ret;
+}
@@ -0,0 +1,62 @@
+/* See LICENSE for licence details. */
+/* host stub of NDK header (for host tools): native window is malloc'ed buffer (see replay() of tools/pagerbench.c) */
+#include <stdint.h>
+
+enum {
+	WINDOW_FORMAT_RGBA_8888 = 1,
+	WINDOW_FORMAT_RGBX_8888 = 2,
+	WINDOW_FORMAT_RGB_565   = 4,
+};
+
+typedef struct {
+	int32_t left, top, right, bottom;
+} ARect;
+
+typedef struct {
+	int32_t width, height, stride, format;
+	void *bits;
+	uint32_t reserved[6];
+} ANativeWindow_Buffer;
+
+typedef struct ANativeWindow {
+	int32_t width, height, format;
+	void *bits;
+	unsigned long posts;    /* statistics: ANativeWindow_unlockAndPost() calls */
+} ANativeWindow;
+
+struct android_app {
+	ANativeWindow *window;
+};
+
+static inline int32_t ANativeWindow_getWidth(ANativeWindow *window)
+{
+	return window->width;
+}
+
+static inline int32_t ANativeWindow_getHeight(ANativeWindow *window)
+{
+	return window->height;
+}
+
+static inline int32_t ANativeWindow_getFormat(ANativeWindow *window)
+{
+	return window->format;
+}
+
+/* whole window is locked: dirty rect is not changed */
+static inline int32_t ANativeWindow_lock(ANativeWindow *window, ANativeWindow_Buffer *buf, ARect *rect)
+{
+	(void) rect;
+	buf->width  = window->width;
+	buf->height = window->height;
+	buf->stride = window->width;
+	buf->format = window->format;
+	buf->bits   = window->bits;
+	return 0;
+}
+
+static inline int32_t ANativeWindow_unlockAndPost(ANativeWindow *window)
+{
+	window->posts++;
+	return 0;
+}
@@ -0,0 +1,129 @@
+/* See LICENSE for licence details. */
+/* common part of host tools: terminal core (android headers are replaced by stubs in tools/stub/),
+	random numbers and timer */
+#include "yaft.h"
+#include "glyph.h"
+#include "conf.h"
+#include "color.h"
+#include "util.h"
+#include "font.h"
+#include "wcwidth.h"
+#include "terminal.h"
+#include "sixel.h"
+#include "drcs.h"
+#include "osc.h"
+#include "function.h"
+#include "parse.h"
+
+/* xorshift32: same seed gives same stream on any host */
+static uint32_t rnd_state = 1;
+
+static inline void rnd_seed(uint32_t seed)
+{
+	rnd_state = (seed == 0) ? 1: seed;
+}
+
+static inline uint32_t rnd(int n)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state % n;
+}
+
+static inline int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* terminal of cols x lines (compiled-in font or PSF2 font of same cell size): output is discarded */
+void open_term(struct terminal *term, int cols, int lines)
+{
+	term_init(term, cols * CELL_WIDTH, lines * CELL_HEIGHT, 1);
+	term->fd = eopen("/dev/null", O_WRONLY);
+}
+
+void close_term(struct terminal *term)
+{
+	eclose(term->fd);
+	term_die(term);
+}
+
+/* cells (compared by colors and attribute, not by style ID), cursor and hashes: return number of errors */
+int compare_term(struct terminal *ref, struct terminal *term)
+{
+	int i, errors = 0;
+	struct style_t *rs, *ts;
+
+	for (i = 0; i < ref->cols * ref->lines; i++) {
+		rs = cell_style(ref, ref->cells.style[i]);
+		ts = cell_style(term, term->cells.style[i]);
+		errors += (ref->cells.code[i] != term->cells.code[i] || ref->cells.width[i] != term->cells.width[i]
+			|| memcmp(&rs->color_pair, &ts->color_pair, sizeof(struct color_pair_t)) != 0
+			|| rs->attribute != ts->attribute);
+	}
+	for (i = 0; i < ref->lines; i++)
+		errors += (ref->line_hash[i] != term->line_hash[i]);
+
+	errors += (ref->cursor.x != term->cursor.x || ref->cursor.y != term->cursor.y
+		|| ref->wrap_occured != term->wrap_occured
+		|| ref->scroll.top != term->scroll.top || ref->scroll.bottom != term->scroll.bottom);
+	return errors;
+}
+
+/* UTF-8 of code point: return length */
+static int utf8_encode(uint32_t code, uint8_t *buf)
+{
+	if (code < 0x80) {
+		buf[0] = code;
+		return 1;
+	}
+	else if (code < 0x800) {
+		buf[0] = 0xC0 | (code >> 6);
+		buf[1] = 0x80 | (code & 0x3F);
+		return 2;
+	}
+	else if (code < 0x10000) {
+		buf[0] = 0xE0 | (code >> 12);
+		buf[1] = 0x80 | ((code >> 6) & 0x3F);
+		buf[2] = 0x80 | (code & 0x3F);
+		return 3;
+	}
+	buf[0] = 0xF0 | (code >> 18);
+	buf[1] = 0x80 | ((code >> 12) & 0x3F);
+	buf[2] = 0x80 | ((code >> 6) & 0x3F);
+	buf[3] = 0x80 | (code & 0x3F);
+	return 4;
+}
+
+/* PSF2 font of width x height (half width glyphs) to existing file: glyph i is code[i] in unicode table */
+void write_psf2(const char *path, int width, int height, const uint32_t *code, int codes)
+{
+	int fd, i, len;
+	uint8_t *bitmap, entry[5];
+	struct psf2_header_t header = {
+		.magic = PSF2_MAGIC, .headersize = sizeof(struct psf2_header_t), .flags = PSF2_HAS_UNICODE,
+		.length = codes, .charsize = height * my_ceil(width, BITS_PER_BYTE), .height = height, .width = width,
+	};
+
+	fd = eopen(path, O_WRONLY | O_TRUNC);
+	ewrite(fd, &header, sizeof(header));
+
+	/* any bits: glyphs are only decoded, never checked */
+	bitmap = (uint8_t *) ecalloc(header.charsize, 1);
+	for (i = 0; i < codes; i++) {
+		memset(bitmap, i, header.charsize);
+		ewrite(fd, bitmap, header.charsize);
+	}
+	free(bitmap);
+
+	for (i = 0; i < codes; i++) {
+		len = utf8_encode(code[i], entry);
+		entry[len++] = PSF2_SEPARATOR;
+		ewrite(fd, entry, len);
+	}
+	eclose(fd);
+}